@@ -131,6 +131,21 @@
 #define UPDI_CLK 225
 #define PDI_CLK  2500
 
+/*
+ * Minimum wait before the UPDI chip erase status is polled.
+ * LSB=1ms, indexed by the NVM version 0-5.
+ * Raise an entry if some silicon needs time to settle after the erase key.
+ */
+
+#define UPDI_ERASE_SETTLE {0, 0, 0, 0, 0, 0}
+
+/*
+ * Longest UPDI chip erase that is waited for. LSB=1ms
+ * The erase fails after this, even if the outer timeout is longer.
+ */
+
+#define UPDI_ERASE_TIMEOUT 500
+
 /*
  * TPI Program interface operating clock.
  * This cannot be changed with avrdude and will always use this value.
@@ -205,6 +220,20 @@
 //#define CONFIG_USB_SERIALNUMBER 0x12345678
 #endif
 
+/*
+ * Enable the vendor bulk interface.
+ *
+ * Interface #3 adds a bulk OUT/IN pair (0x04/0x84) that carries
+ * the same JTAG3 payloads as the HID, without the 60-byte EDBG framing.
+ * A payload of 512 or 896 bytes at most is accepted in one transfer,
+ * which ends with a short packet or a ZLP.
+ *
+ * AVRDUDE keeps working over the HID. Host tools need WinUSB or libusb.
+ * Use a distinct PID, as this changes the configuration descriptor.
+ */
+
+// #define CONFIG_USB_VENDOR_BULK
+
 /*** CONFIG_VCP ***/
 
 /*
@@ -226,6 +255,39 @@
 
 // #define CONFIG_VCP_INTERRUPT_SUPPRT
 
+/*
+ * Enable the VCP ring buffers.
+ *
+ * VCP-RxD is kept in a ring buffer of VCP_RXBUF_SIZE until the host takes it,
+ * and VCP-TxD is sent from a ring buffer of VCP_TXBUF_SIZE by the DRE interrupt.
+ * When full, the host is held off with NAK and the target with PIN_VCP_RTS
+ * instead of discarding data. PIN_VCP_CTS stops VCP-TxD with CONFIG_VCP_CTS_ENABLE.
+ *
+ * Sizes must be a power of 2.
+ * Only available with 8KB or more SRAM.
+ */
+
+#define CONFIG_VCP_RINGBUFFER
+#define VCP_RXBUF_SIZE 2048
+#define VCP_TXBUF_SIZE 1024
+
+/*
+ * Enable the second VCP.
+ *
+ * A second CDC-ACM function is added on USART1 (DTxD/DRxD, PD6/PD7)
+ * with its own line coding, ring buffers and flush latency.
+ * It keeps running while the first VCP is used for programming.
+ *
+ * Sizes must be a power of 2.
+ * Only on 28/32-pin bare metal boards, and not with DEBUG or
+ * CONFIG_UPDI_GANG, which also use USART1.
+ * Use a distinct PID, as this changes the configuration descriptor.
+ */
+
+// #define CONFIG_VCP_SECOND
+#define VCP2_RXBUF_SIZE 512
+#define VCP2_TXBUF_SIZE 256
+
 /*** CONFIG_HVC ***/
 
 /*
@@ -249,6 +311,14 @@
 
 #define CONFIG_PGM_PDI_ENABLE
 
+/*
+ * Enable TPI type programming support.
+ *
+ * Disable it for a UPDI-only build.
+ */
+
+#define CONFIG_PGM_TPI_ENABLE
+
 /*
  * Enable the VTG-Power switch.
  *
@@ -263,6 +333,61 @@
 
 #define CONFIG_PGM_VPOWER_ENABLE
 
+/*
+ * Enable gang programming on two UPDI channels.
+ *
+ * USART1 drives a second UPDI target from TDAT1 (PD6) in lockstep
+ * with the first. Both receive the same JTAG3 stream, and channel 1
+ * leaves the gang on its first differing character. Status polls
+ * are merged, so the slower target sets the pace.
+ * CMD3_VENDOR_GANG_STATUS (0x72) reports each channel.
+ *
+ * TRST, VPOWER and HV control are shared or on channel 0 only.
+ * Only on 28/32-pin bare metal boards, and not with DEBUG (USART1 console).
+ */
+
+// #define CONFIG_UPDI_GANG
+
+/*
+ * Enable the performance counters.
+ *
+ * Time spent in the hot paths is accumulated in RTC ticks (1/32768 sec),
+ * along with timeouts taken and bytes moved per memory type.
+ * They are read and cleared with a vendor request (see <usb.cpp>).
+ * Without this option the request answers with no data.
+ *
+ * The RTC is read on every hot path, so this is opt-in.
+ */
+
+// #define CONFIG_SYS_PERFCOUNT
+
+/*
+ * Enable standalone programming.
+ *
+ * A UPDI flash image and its fuses are stored in the upper 32KiB
+ * of the programmer's own flash with a vendor EDBG command.
+ * Releasing SW0 while no USB host is connected writes, verifies
+ * and fuses the target from this image without the host.
+ *
+ * The FUSE BOOTSIZE is changed so the firmware can write the upper half.
+ * Only available on 64KiB parts.
+ */
+
+// #define CONFIG_SYS_STANDALONE
+
+/*
+ * Enable the adaptive power sequencing.
+ *
+ * The fixed waits around the VPW power cycle become upper bounds.
+ * The discharge ends once TDAT has read LOW for 10ms in a row,
+ * and the power up once it has read HIGH for 100us in a row.
+ * A target with a large bulk capacitance may not drop below its POR
+ * level by then, so it is left to the boards that are known to work.
+ * It only acts on the UPDI and TPI sessions.
+ */
+
+// #define CONFIG_SYS_POWER_ADAPTIVE
+
 /********************************
  * Do not change it after this. *
  ********************************/
@@ -300,6 +425,36 @@
 #ifdef CONFIG_PGM_PDI_DISABLE
   #undef CONFIG_PGM_PDI_ENABLE
 #endif
+#ifdef CONFIG_PGM_TPI_DISABLE
+  #undef CONFIG_PGM_TPI_ENABLE
+#endif
+#ifdef CONFIG_UPDI_GANG_DISABLE
+  #undef CONFIG_UPDI_GANG
+#endif
+#ifdef CONFIG_SYS_PERFCOUNT_DISABLE
+  #undef CONFIG_SYS_PERFCOUNT
+#endif
+#ifdef CONFIG_SYS_STANDALONE_DISABLE
+  #undef CONFIG_SYS_STANDALONE
+#endif
+#ifdef CONFIG_SYS_POWER_ADAPTIVE_DISABLE
+  #undef CONFIG_SYS_POWER_ADAPTIVE
+#endif
+#if (PROGMEM_SIZE < 65536)
+  #undef CONFIG_SYS_STANDALONE
+#endif
+#if defined(CONFIG_SYS_STANDALONE)
+  #define STANDALONE_BASE 0x8000    /* image store : upper 32KiB */
+#endif
+#ifdef CONFIG_VCP_RINGBUFFER_DISABLE
+  #undef CONFIG_VCP_RINGBUFFER
+#endif
+#ifdef CONFIG_VCP_SECOND_DISABLE
+  #undef CONFIG_VCP_SECOND
+#endif
+#if defined(CONFIG_VCP_9BIT_SUPPORT) || (INTERNAL_SRAM_SIZE < 8192)
+  #undef CONFIG_VCP_RINGBUFFER
+#endif
 
 #if (CONFIG_HAL_TYPE == HAL_BAREMETAL_14P)
   #undef DEBUG
@@ -382,6 +537,9 @@
   #define PIN_SYS_LED0        PIN_LUT2_OUT
   #define PIN_SYS_LED1        PIN_LUT1_OUT
   #define PIN_SYS_SW0         PIN_PA5
+  #define PIN_PGM_TDAT1       PIN_USART1_TXD_ALT2
+  #define PIN_VCP2_TXD        PIN_USART1_TXD_ALT2
+  #define PIN_VCP2_RXD        PIN_USART1_RXD_ALT2
 
 #endif
 
@@ -393,4 +551,12 @@
   #undef CONFIG_PGM_VPOWER_ENABLE
 #endif
 
+#if !defined(PIN_PGM_TDAT1) || defined(DEBUG)
+  #undef CONFIG_UPDI_GANG
+#endif
+
+#if !defined(PIN_VCP2_TXD) || defined(DEBUG) || defined(CONFIG_UPDI_GANG)
+  #undef CONFIG_VCP_SECOND
+#endif
+
 // end of header
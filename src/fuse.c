@@ -33,6 +33,13 @@
   #define ENABLE_SYS_RESET 0
 #endif
 
+#if defined(CONFIG_SYS_STANDALONE)
+  /* The firmware runs in BOOT so it can write the image store in APPCODE. */
+  #define BOOT_SECTION_SIZE (STANDALONE_BASE / 512)
+#else
+  #define BOOT_SECTION_SIZE FUSE8_DEFAULT
+#endif
+
 FUSES = {
     .WDTCFG   = FUSE0_DEFAULT,
     .BODCFG   = FUSE1_DEFAULT,
@@ -40,7 +47,7 @@ FUSES = {
     .SYSCFG0  = FUSE5_DEFAULT | FUSE_EESAVE_bm | ENABLE_SYS_RESET,
     .SYSCFG1  = FUSE6_DEFAULT,
     .CODESIZE = FUSE7_DEFAULT,  /* 0=All application code */
-    .BOOTSIZE = FUSE8_DEFAULT,  /* 0=No bootloader */
+    .BOOTSIZE = BOOT_SECTION_SIZE, /* 0=No bootloader, 64=32KiB BOOT */
     .PDICFG   = FUSE10_DEFAULT  /* Never change it */
 };
 
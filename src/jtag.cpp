@@ -42,6 +42,44 @@ namespace JTAG {
   const uint8_t PROGMEM jtag_version[] = CONFIG_SYS_FWVER;
   const uint8_t PROGMEM jtag_physical[] = {0x90, 0x28, 0x00, 0x18, 0x38, 0x00, 0x00, 0x00};
 
+  /*
+   * Reassembles one EDBG fragment into the given packet slot.
+   * Returns true if the last fragment completes the payload.
+   */
+  bool dap_defragment (JTAG_Packet_t* _slot, size_t* _length, uint8_t* _chunks) {
+    uint8_t _sub  = EP_MEM.dap_data[1];
+    uint8_t _endf = _sub & 0x0F;
+    uint8_t _frag = _sub >> 4;
+    uint8_t _size = EP_MEM.dap_data[3];
+    size_t  _ofst = (_frag - 1) * 60;
+    if (_endf > JTAG_FRAGMENTS) {
+      /* Only a maximum of JTAG_PACKET_SIZE : 9 or 15 fragment records is accepted. */
+      D1PRINTF("<EDBG_FAIL>\r\n");
+      EP_MEM.dap_data[1] = 0x00;    /* EDBG_RSP_FAIL */
+      return false;
+    }
+    /* Detect the first chunk. */
+    if (_frag == 1) *_chunks = 0;
+    ++*_chunks;
+    memcpy(&_slot->rawData[_ofst], &EP_MEM.dap_data[4], _size);
+    EP_MEM.dap_data[1] = 0x01;      /* EDBG_RSP_OK */
+    D3PRINTHEX(&EP_MEM.dap_data, _size + 4);
+    if (_endf != _frag) return false;
+    /* end of defragment */
+    *_length = _ofst + _size;
+    D2PRINTF(" SQ=%03X:%03X<", _slot->out.sequence, *_length);
+    D2PRINTHEX(_slot, *_length);
+    if (*_chunks != _endf) {
+      /* A missing chunk is detected, so an error is returned. */
+      D1PRINTF("<EDBG_FAIL>\r\n");
+      EP_MEM.dap_data[1] = 0x00;    /* EDBG_RSP_FAIL */
+      return false;
+    }
+    /* True if an EDBG Payload is received. */
+    D2PRINTF("<EDBG_OK>\r\n");
+    return true;
+  }
+
   /*** Only a subset of the CMSIS-DAP commands are implemented. ***/
   /*
    * Command numbers 0x80 and above are vendor extensions, EDBG Payload uses 0x80 and x81.
@@ -63,39 +101,12 @@ namespace JTAG {
      * resulting in a maximum payload length of 900 bytes.
      */
     if (_cmd == 0x80) {             /* DAP_EDBG_VENDOR_AVR_CMD */
-      uint8_t _endf = _sub & 0x0F;
-      uint8_t _frag = _sub >> 4;
-      uint8_t _size = EP_MEM.dap_data[3];
-      size_t  _ofst = (_frag - 1) * 60;
-      if (_endf >= 10) {
-        /* Only a maximum of 540 bytes : 9 fragment records is accepted. */
-        D1PRINTF("<EDBG_FAIL>\r\n");
-        EP_MEM.dap_data[1] = 0x00;  /* EDBG_RSP_FAIL */
-      }
-      else {
-        /* Detect the first chunk. */
-        if (_frag == 1) _packet_chunks = 0;
-        ++_packet_chunks;
-        memcpy(&packet.rawData[_ofst], &EP_MEM.dap_data[4], _size);
-        EP_MEM.dap_data[1] = 0x01;  /* EDBG_RSP_OK */
-        D3PRINTHEX(&EP_MEM.dap_data, _size + 4);
-        if (_endf == _frag) {       /* end of defragment */
-          _packet_length = _ofst + _size;
-          D2PRINTF(" SQ=%03X:%03X<", packet.out.sequence, _packet_length);
-          D2PRINTHEX(&packet, _packet_length);
-          if (_packet_chunks == _endf) {
-            /* True if an EDBG Payload is received. */
-            D2PRINTF("<EDBG_OK>\r\n");
-            _packet_endfrag = 0;
-            _result = true;
-          }
-          else {
-            /* A missing chunk is detected, so an error is returned. */
-            D1PRINTF("<EDBG_FAIL>\r\n");
-            EP_MEM.dap_data[1] = 0x00;  /* EDBG_RSP_FAIL */
-          }
-        }
+      PERF_START(_t);
+      if (dap_defragment(&packet, &_packet_length, &_packet_chunks)) {
+        _packet_endfrag = 0;
+        _result = true;
       }
+      PERF_END(_t, edbg);
     }
     else if (_cmd == 0x81) {        /* DAP_EDBG_VENDOR_AVR_RSP */
       EP_MEM.dap_data[2] = 0;       /* Always zero */
@@ -158,6 +169,36 @@ namespace JTAG {
     return _result; /* True if an EDBG Payload is received. */
   }
 
+#if defined(CONFIG_USB_VENDOR_BULK)
+  /*
+   * The vendor bulk interface carries the same JTAG3 payloads as the EDBG,
+   * received directly into the packet with no 60-byte fragments.
+   * A host uses either this or the HID interface, not both at once.
+   */
+  bool bulk_command_check (void) {
+    if (_bulk_state) {
+      /* Listen again once the host has taken the whole response. */
+      if (USB::is_vbi_pending()) return false;
+      _bulk_state = 0;
+      USB::ep_vbo_listen();
+      return false;
+    }
+    if (USB::is_not_vbulk()) return false;
+    _packet_length = EP_VBO.CNT;
+    D2PRINTF(" SQ=%03X:%03X<", packet.out.sequence, _packet_length);
+    D2PRINTHEX(&packet, _packet_length);
+    return true;
+  }
+
+  void complete_bulk_transactions (void) {
+    /* The response starts at an odd offset, so it is moved to the buffer top. */
+    memmove(&packet.rawData[0], &packet.in.token, _packet_length);
+    _packet_endfrag = 0;  /* Nothing is left for DAP_EDBG_VENDOR_AVR_RSP. */
+    _bulk_state = 1;
+    USB::ep_vbi_listen();
+  }
+#endif
+
   /*** Prepare for EDBG payload request from device to host ***/
   void complete_jtag_transactions (size_t _length) {
     _packet_length = _length + 6; /* TOKEN + SEQ[2] + EOT + PAD */
@@ -200,7 +241,9 @@ namespace JTAG {
     }
     else if (_cmd == 0x10) {        /* CMD3_SIGN_ON */
       D1PRINTF(" GEN_SIGN_ON\r\n");
-      PGCONF = 0;
+      /* A kept UPDI session remains connected and in PROGMODE, but not erased. */
+      PGCONF = _keep_count ? PGCONF & (PGCONF_UPDI_bm | PGCONF_PROG_bm) : 0;
+      _jtag_keep = 0;
       _jtag_hvctrl = 0;
       _jtag_unlock = 0;   /* This is not used. */
       _jtag_arch = 0;
@@ -255,6 +298,13 @@ namespace JTAG {
       packet.in.res = 0x184;        /* RSP3_DATA */
       _rspsize = _length + 1;
     }
+  #if defined(CONFIG_SYS_STANDALONE)
+    else if (_cmd == 0x70) {        /* CMD3_VENDOR_STORE_IMAGE */
+      /* Same fields as CMD3_WRITE_MEMORY, dwAddr=store offset, one page at a time. */
+      D1PRINTF(" EDBG_STORE=%06lX:%04X\r\n", packet.out.dwAddr, (size_t)packet.out.dwLength);
+      packet.in.res = STANDALONE::store_page() ? 0x80 : 0xA0; /* RSP3_OK : RSP3_FAILED */
+    }
+  #endif
     return _rspsize;
   }
 
@@ -357,6 +407,11 @@ namespace JTAG {
           D1PRINTF(" UNLOCKEN=%02X\r\n", _data);
           _jtag_unlock = _data;     /* 1:ENABLE */
         }
+        else if (_index == 0x70) {  /* PARM3_VENDOR_KEEP_SESSION */
+          /* Seconds to stay in PROGMODE after SIGN_OFF. 0:disable */
+          D1PRINTF(" KEEP_SESSION=%d\r\n", _data);
+          _jtag_keep = _data > 60 ? 60 : _data;
+        }
       }
       packet.in.res = 0x80;         /* RSP3_OK */
     }
@@ -380,6 +435,22 @@ namespace JTAG {
           packet.in.wValue = _xclk;
         }
       }
+      else if (_section == 3) {     /* SET_GET_CTXT_OPTIONS */
+        if (_index == 0x70) {       /* PARM3_VENDOR_KEEP_SESSION */
+          D1PRINTF(" KEEP_SESSION=%d\r\n", _jtag_keep);
+          packet.in.data[0] = _jtag_keep;
+        }
+        else if (_index == 0x72) {  /* PARM3_VENDOR_ERASE_TIME */
+          /* The last measured UPDI chip erase. LSB=1ms */
+          D1PRINTF(" ERASE_TIME=%d\r\n", _erase_time);
+          packet.in.wValue = _erase_time;
+        }
+        else if (_index == 0x73) {  /* PARM3_VENDOR_WRITE_SPAN */
+          /* The longest flash write accepted in one packet. 0:not connected */
+          packet.in.wValue = UPDI::write_span();
+          D1PRINTF(" WRITE_SPAN=%d\r\n", packet.in.wValue);
+        }
+      }
       packet.in.res = 0x184;        /* RSP3_DATA */
       _rspsize = _length + 1;
     }
@@ -407,6 +478,9 @@ namespace JTAG {
       packet.out.cmd,
       packet.out.section,
       packet.out.index);
+    /* A kept UPDI session is closed before any other programming interface starts. */
+    if (_keep_count && (_scope == 0x14
+     || (_scope == 0x12 && packet.out.cmd == 0x10 && _jtag_arch != 5))) UPDI::keep_expire();
     if      (_scope == 0x01) _rspsize = jtag_scope_general();       /* SCOPE_GENERAL */
   #ifdef _Not_yet_implemented_stub_
     else if (_scope == 0x00) _rspsize = jtag_scope_info();          /* SCOPE_INFO */ /* Not used with EDBG/CMSIS-DAP type */
@@ -414,7 +488,9 @@ namespace JTAG {
     else if (_scope == 0x13) _rspsize = AVR32::jtag_scope_avr32();  /* SCOPE_AVR32 */
   #endif
     else if (_scope == 0x12) _rspsize = jtag_scope_avr_core();      /* SCOPE_AVR */
+  #ifdef CONFIG_PGM_TPI_ENABLE
     else if (_scope == 0x14) _rspsize = TPI::jtag_scope_tpi();      /* SCOPE_AVR_TPI */
+  #endif
     else if (_scope == 0x20) _rspsize = jtag_scope_edbg();          /* SCOPE_EDBG */
     complete_jtag_transactions(_rspsize);
   } /* jtag_scope_branch */
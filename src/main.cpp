@@ -27,11 +27,21 @@ namespace /* NAMELESS */ {
   /* SYS */
   NOINIT jmp_buf TIMEOUT_CONTEXT;
   uint8_t _led_mode = 0;
+#if defined(CONFIG_SYS_PERFCOUNT)
+  Perf_Counter_t _perf;               /* zero at startup */
+#endif
 
   /* USB */
   alignas(2) NOINIT EP_TABLE_t EP_TABLE;
   alignas(2) NOINIT EP_DATA_t EP_MEM;
   NOINIT Device_Desc_t Device_Descriptor;
+  alignas(2) NOINIT uint8_t _res_piece[64];  /* EP0 IN answered from USB::yield */
+  NOINIT uint16_t _res_index, _res_offset, _res_length;
+  uint8_t _res_pieces = 0;            /* 1:a descriptor is being answered */
+  uint8_t _deferred_class = 0;        /* DEFER_* taken inside a command */
+  NOINIT LineEncoding_t _deferred_encoding;
+  NOINIT uint8_t  _deferred_state;
+  NOINIT uint16_t _deferred_break;
 
   /* Vertual Communication Port */
 #if defined(CONFIG_VCP_9BIT_SUPPORT)
@@ -46,13 +56,39 @@ namespace /* NAMELESS */ {
   NOINIT uint8_t _set_config;
   NOINIT volatile uint8_t _sof_count;
   NOINIT uint8_t _set_serial_state;
+  uint8_t  _flush_latency = 30;       /* LSB=1ms <- USB SOF */
+  uint8_t  _flush_override = 0;       /* LSB=1ms 0:auto */
+  uint16_t _flush_term = 0;           /* 0x100+char:enable 0:disable */
+#if defined(CONFIG_VCP_RINGBUFFER)
+  NOINIT uint8_t _vcp_rxbuf[VCP_RXBUF_SIZE];  /* VCP-RxD -> USB */
+  NOINIT uint8_t _vcp_txbuf[VCP_TXBUF_SIZE];  /* USB -> VCP-TxD */
+  NOINIT volatile uint16_t _vcp_rxhead, _vcp_rxtail;
+  NOINIT volatile uint16_t _vcp_txhead, _vcp_txtail;
+#endif
+#if defined(CONFIG_VCP_SECOND)
+  LineEncoding_t _vcp2_encoding;
+  LineState_t    _vcp2_state;
+  NOINIT uint16_t _vcp2_break;
+  NOINIT volatile uint8_t _vcp2_sof;
+  NOINIT volatile uint8_t _vcp2_conf;
+  NOINIT volatile uint8_t _vcp2_rxstat;
+  NOINIT uint8_t _vcp2_serial_state;
+  uint8_t  _vcp2_latency = 30;        /* LSB=1ms <- USB SOF */
+  NOINIT uint8_t _vcp2_rxbuf[VCP2_RXBUF_SIZE];  /* VCP2-RxD -> USB */
+  NOINIT uint8_t _vcp2_txbuf[VCP2_TXBUF_SIZE];  /* USB -> VCP2-TxD */
+  NOINIT volatile uint16_t _vcp2_rxhead, _vcp2_rxtail;
+  NOINIT volatile uint16_t _vcp2_txhead, _vcp2_txtail;
+#endif
 
   /* JTAG packet payload */
-  NOINIT JTAG_Packet_t packet;
+  alignas(2) NOINIT JTAG_Packet_t packet;
   NOINIT size_t  _packet_length;
   NOINIT uint8_t _packet_fragment;
   NOINIT uint8_t _packet_chunks;
   NOINIT uint8_t _packet_endfrag;
+#if defined(CONFIG_USB_VENDOR_BULK)
+  uint8_t _bulk_state = 0;            /* 0:LISTEN 1:RESPONDING */
+#endif
 
   /* JTAG parameter */
   NOINIT uint32_t _before_page;
@@ -64,10 +100,19 @@ namespace /* NAMELESS */ {
   NOINIT uint8_t _jtag_arch;
   NOINIT uint8_t _jtag_sess;
   NOINIT uint8_t _jtag_conn;
+  NOINIT uint8_t _jtag_keep;          /* LSB=1sec */
+  NOINIT uint16_t _keep_xclk;
+  volatile uint16_t _keep_count = 0;  /* LSB=1ms <- USB SOF */
 
   /* UPDI parameter */
   NOINIT Command_Table_t Command_Table;
   NOINIT uint8_t _sib[32];
+  NOINIT uint8_t _delta_map[64];      /* 1:identical flash page */
+  NOINIT uint8_t _write_map[64];      /* 1:flash page written since the chip erase */
+  uint16_t _erase_time = 0;           /* LSB=1ms, last chip erase */
+#if defined(CONFIG_UPDI_GANG)
+  uint8_t _gang_state = 0;            /* 0:SINGLE 1:LOCKSTEP 2:DROPPED */
+#endif
 
   /* TPI parameter */
   NOINIT uint8_t _tpi_cmd_addr;
@@ -123,8 +168,12 @@ int main (void) {
 
     /*** USB control handling ***/
     USB::handling_bus_events();
+    USB::handling_deferred();
     if (USB::is_ep_setup()) USB::handling_control_transactions();
 
+    /* When the kept UPDI session times out, the deferred SIGN_OFF is done. */
+    if (_keep_count == 1) UPDI::keep_expire();
+
     /* If SW0 was used, work here. */
     if (bit_is_clear(PGCONF, PGCONF_UPDI_bp)) {
       if      (bit_is_set(GPCONF, GPCONF_FAL_bp)) SYS::reset_enter();
@@ -139,6 +188,7 @@ int main (void) {
     /* an interrupt. At the maximum speed of the VCP-RxD, one   */
     /* character arrives every 400 clocks on a 20MHz reference. */
     /* So we avoid using interrupts here and use polling to gain speed. */
+    /* With the ring buffers, only VCP-TxD is left to the DRE interrupt. */
   #if defined(CONFIG_VCP_9BIT_SUPPORT)
     if (bit_is_set(GPCONF, GPCONF_VCP_bp)) usart_transmitter();
   #else
@@ -149,6 +199,19 @@ int main (void) {
     /*** If the break value is between 1 and 65534, it will count down. ***/
     if (bit_is_set(GPCONF, GPCONF_BRK_bp)) USB::cci_break_count();
 
+  #if defined(CONFIG_VCP_SECOND)
+    /*** The second VCP runs on USART1, independent of the programming state. ***/
+    USB::vcp2_transceiver();
+  #endif
+
+  #if defined(CONFIG_USB_VENDOR_BULK)
+    /*** JTAG3 payloads on the vendor bulk interface, without EDBG framing. ***/
+    if (JTAG::bulk_command_check()) {
+      JTAG::jtag_scope_branch();
+      JTAG::complete_bulk_transactions();
+    }
+  #endif
+
     /*** If CMSIS-DAP is not received, return to the top. ***/
     if (USB::is_not_dap()) {
       /* To force exit from a non-responsive terminal mode, press SW0. */
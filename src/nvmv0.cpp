@@ -59,7 +59,11 @@ namespace NVM::V0 {
   constexpr auto PROD_SIG   = 0x1100;
 
   uint8_t nvm_wait (void) {
-    do { UPDI::recv_byte(NVM_STATUS); } while (RXDATA & 3);
+    PERF_START(_t);
+    GANG_MERGE(1);
+    do { USB::yield(); UPDI::recv_byte(NVM_STATUS); } while (RXDATA & 3);
+    GANG_MERGE(0);
+    PERF_END(_t, nvm_wait);
     return RXDATA;
   }
 
@@ -68,40 +72,59 @@ namespace NVM::V0 {
       uint16_t data;  /* NVMCTRL_REG_DATA */
       uint16_t addr;  /* NVMCTRL_REG_ADDR */
     } fuses;
+    /* DATA and ADDR are contiguous, so both go in one RSD stream. */
+    nvm_wait();
     for (size_t _i = 0; _i < _wLength; _i++) {
       fuses.data = packet.out.memData[_i];
       fuses.addr = _wAddr + _i;
       D2PRINTF(" NVM_V0_WFU=%04X<%02X\r\n", fuses.addr, fuses.data);
-      nvm_wait();
-      if (!(UPDI::send_bytes_data(NVM_DATA, (uint8_t*)&fuses, 4)
+      if (!(UPDI::repeat_block(NVM_DATA, (uint8_t*)&fuses, 4, 0x64)
         && UPDI::nvm_ctrl(0x07)   /* NVM_CMD_WFU */
         && (nvm_wait() & 7) == 0)) return false;
     }
     return true;
   }
 
+  /* A packet spanning several flash pages is written one page at a time. */
   bool write_flash (uint16_t _wAddr, size_t _wLength) {
-    D2PRINTF(" NVM_V0_ERWP=%04X\r\n", _wAddr);
-    if (SYS::is_boundary_flash_page(_wAddr)) {
+    uint16_t _psize = UPDI::flash_page_size();
+    uint8_t* _data = &packet.out.memData[0];
+    do {
+      size_t _len = _psize ? _psize - (_wAddr & (_psize - 1)) : _wLength;
+      if (_len > _wLength) _len = _wLength;
+      D2PRINTF(" NVM_V0_ERWP=%04X\r\n", _wAddr);
+      if (SYS::is_boundary_flash_page(_wAddr)) {
+        nvm_wait();
+        UPDI::nvm_ctrl(0x04);     /* NVM_CMD_PBC */
+      }
       nvm_wait();
-      UPDI::nvm_ctrl(0x04);       /* NVM_CMD_PBC */
-    }
-    nvm_wait();
-    return (
-      UPDI::send_bytes_block(_wAddr, _wLength)
-      && UPDI::nvm_ctrl(0x03)     /* NVM_CMD_ERWP */
-      && (nvm_wait() & 7) == 0
-    );
+      if (!(UPDI::repeat_block(_wAddr, _data, _len, 0x64)
+        && UPDI::nvm_ctrl(0x03)   /* NVM_CMD_ERWP */
+        && (nvm_wait() & 7) == 0)) return false;
+      _wAddr   += _len;
+      _data    += _len;
+      _wLength -= _len;
+    } while (_wLength);
+    return true;
   }
 
+  /* A packet longer than the EEPROM page is split at the page boundaries. */
   bool write_eeprom (uint16_t _wAddr, size_t _wLength) {
-    D2PRINTF(" NVM_V0_ERWP=%04X\r\n", _wAddr);
+    uint8_t _psize = Device_Descriptor.UPDI.eeprom_page_size;
+    uint8_t* _data = &packet.out.memData[0];
     nvm_wait();
-    return (
-      UPDI::send_bytes_block(_wAddr, _wLength)
-      && UPDI::nvm_ctrl(0x03)     /* NVM_CMD_ERWP */
-      && (nvm_wait() & 7) == 0
-    );
+    do {
+      size_t _len = _psize ? _psize - (_wAddr & (_psize - 1)) : _wLength;
+      if (_len > _wLength) _len = _wLength;
+      D2PRINTF(" NVM_V0_ERWP=%04X\r\n", _wAddr);
+      if (!(UPDI::repeat_block(_wAddr, _data, _len, 0x64)
+        && UPDI::nvm_ctrl(0x03)   /* NVM_CMD_ERWP */
+        && (nvm_wait() & 7) == 0)) return false;
+      _wAddr   += _len;
+      _data    += _len;
+      _wLength -= _len;
+    } while (_wLength);
+    return true;
   }
 
   size_t prog_init (void) {
@@ -158,6 +181,7 @@ namespace NVM::V0 {
     else if (m_type == 0xB0 || m_type == 0xC0) {
       /* MTYPE_FLASH_PAGE (PROGMEM) */
       /* MTYPE_FLASH (alias) */
+      if (UPDI::is_blank_page()) return true;
       _wAddr += Device_Descriptor.UPDI.prog_base;
       return write_flash(_wAddr, _wLength);
     }
@@ -36,12 +36,15 @@
  * - EEPROM can be written in units of up to 2 bytes.
  *   The normal setting for AVRDUDE is to read and write in units of 1 byte,
  *   which is very slow. Setting page_size=2 can improve this speed.
+ *   Longer packets are streamed as words, with one status wait at the end.
  *
  * - FUSE should be written in the same way as EEPROM.
  *
  * - Flash can be written in units of 512 bytes.
  *
  * - Erasing and rewriting a flash memory page are separate commands.
+ *   The write commands are left set between packets, and NOCMD
+ *   is only written when the next command differs.
  *
  * - A page erase is required because USERROW is written to in the same way as flash.
  */
@@ -54,16 +57,17 @@ namespace NVM::V2 {
   constexpr auto PROG_START = 0x800000;
 
   uint8_t nvm_wait (void) {
-    do { UPDI::recv_byte(NVM_STATUS); } while (RXDATA & 3);
+    PERF_START(_t);
+    GANG_MERGE(1);
+    do { USB::yield(); UPDI::recv_byte(NVM_STATUS); } while (RXDATA & 3);
+    GANG_MERGE(0);
+    UPDI::nvm_idle();
+    PERF_END(_t, nvm_wait);
     return RXDATA;
   }
 
   bool nvm_ctrl_change (uint8_t _nvmcmd) {
-    nvm_wait();
-    if (UPDI::recv_byte(NVM_CTRL) && RXDATA == _nvmcmd) return true;
-    if (!UPDI::nvm_ctrl(0x00)) return false;
-    if (0 != _nvmcmd) return UPDI::nvm_ctrl(_nvmcmd);
-    return true;
+    return UPDI::nvm_ctrl_change(_nvmcmd, &nvm_wait);
   }
 
   bool erase_flash_page (uint32_t _dwAddr) {
@@ -72,7 +76,6 @@ namespace NVM::V2 {
       nvm_ctrl_change(0x08)   /* NVM_V2_CMD_FLPER */
       && UPDI::send_byte(_dwAddr, 0xFF)
       && (nvm_wait() & 0x73) == 0
-      && nvm_ctrl_change(0x00)
     );
   }
 
@@ -84,7 +87,6 @@ namespace NVM::V2 {
       nvm_ctrl_change(0x02)   /* NVM_V2_CMD_FLWR */
       && UPDI::send_words_block(_dwAddr, _wLength)
       && (nvm_wait() & 0x73) == 0
-      && nvm_ctrl_change(0x00)
     );
   }
 
@@ -93,9 +95,8 @@ namespace NVM::V2 {
     D2PRINTF(" NVM_V2_FLWR=%06lX\r\n", _dwAddr);
     return (
       nvm_ctrl_change(0x02)   /* NVM_V2_CMD_FLWR */
-      && UPDI::send_bytes_block_slow(_dwAddr, _wLength)
+      && UPDI::send_bytes_block_paced(_dwAddr, _wLength)
       && (nvm_wait() & 0x73) == 0
-      && nvm_ctrl_change(0x00)
     );
   }
 
@@ -103,9 +104,8 @@ namespace NVM::V2 {
     D2PRINTF(" NVM_V2_EEERWR=%06lX\r\n", _dwAddr);
     return (
       nvm_ctrl_change(0x13)   /* NVM_V2_CMD_EEERWR */
-      && UPDI::send_bytes_block_slow(_dwAddr, _wLength)
+      && UPDI::send_bytes_block_paced(_dwAddr, _wLength)
       && (nvm_wait() & 0x73) == 0
-      && nvm_ctrl_change(0x00)
     );
   }
 
@@ -171,6 +171,7 @@ namespace NVM::V2 {
     }
     else if (m_type == 0xB0) {
       /* MTYPE_FLASH_PAGE (PROGMEM) */
+      if (UPDI::is_blank_page()) return true;
       _dwAddr += PROG_START;
       return write_words_flash(_dwAddr, _wLength);
     }
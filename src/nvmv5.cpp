@@ -55,36 +55,44 @@ namespace NVM::V5 {
   constexpr auto PROG_START = 0x800000;
 
   uint8_t nvm_wait (void) {
-    do { UPDI::recv_byte(NVM_STATUS); } while (RXDATA & 3);
+    PERF_START(_t);
+    GANG_MERGE(1);
+    do { USB::yield(); UPDI::recv_byte(NVM_STATUS); } while (RXDATA & 3);
+    GANG_MERGE(0);
+    UPDI::nvm_idle();
+    PERF_END(_t, nvm_wait);
     return RXDATA;
   }
 
   bool nvm_ctrl_change (uint8_t _nvmcmd) {
-    nvm_wait();
-    if (UPDI::recv_byte(NVM_CTRL) && RXDATA == _nvmcmd) return true;
-    if (!UPDI::nvm_ctrl(0x00)) return false;
-    if (0 != _nvmcmd) return UPDI::nvm_ctrl(_nvmcmd);
+    return UPDI::nvm_ctrl_change(_nvmcmd, &nvm_wait);
+  }
+
+  /* A packet spanning several flash pages is written one page at a time. */
+  bool write_flash_pages (uint32_t _dwAddr, size_t _wLength, uint8_t _op) {
+    uint16_t _psize = UPDI::flash_page_size();
+    uint8_t* _data = &packet.out.memData[0];
+    do {
+      size_t _len = _psize ? _psize - (_dwAddr & (_psize - 1)) : _wLength;
+      if (_len > _wLength) _len = _wLength;
+      D2PRINTF(" NVM_V5_FLPERW=%06lX\r\n", _dwAddr);
+      if (!(nvm_ctrl_change(0x00)
+        && UPDI::repeat_block(_dwAddr, _data, _len, _op)
+        && nvm_ctrl_change(0x05)  /* NVM_V5_CMD_FLPERW */
+        && (nvm_wait() & 0x73) == 0)) return false;
+      _dwAddr  += _len;
+      _data    += _len;
+      _wLength -= _len;
+    } while (_wLength);
     return true;
   }
 
   bool write_words_flash (uint32_t _dwAddr, size_t _wLength) {
-    D2PRINTF(" NVM_V5_FLPERW=%06lX\r\n", _dwAddr);
-    return (
-      nvm_ctrl_change(0x00)
-      && UPDI::send_words_block(_dwAddr, _wLength)
-      && nvm_ctrl_change(0x05)  /* NVM_V5_CMD_FLPERW */
-      && (nvm_wait() & 0x73) == 0
-    );
+    return write_flash_pages(_dwAddr, _wLength, 0x65);  /* ST PTR++ DATA2 */
   }
 
   bool write_bytes_flash (uint32_t _dwAddr, size_t _wLength) {
-    D2PRINTF(" NVM_V5_FLPERW=%06lX\r\n", _dwAddr);
-    return (
-      nvm_ctrl_change(0x00)
-      && UPDI::send_bytes_block(_dwAddr, _wLength)
-      && nvm_ctrl_change(0x05)  /* NVM_V5_CMD_FLPERW */
-      && (nvm_wait() & 0x73) == 0
-    );
+    return write_flash_pages(_dwAddr, _wLength, 0x64);  /* ST PTR++ DATA1 */
   }
 
   bool write_eeprom (uint32_t _dwAddr, size_t _wLength) {
@@ -152,6 +160,7 @@ namespace NVM::V5 {
     }
     else if (m_type == 0xB0) {
       /* MTYPE_FLASH_PAGE (PROGMEM) */
+      if (UPDI::is_blank_page()) return true;
       _dwAddr += PROG_START;
       return write_words_flash(_dwAddr, _wLength);
     }
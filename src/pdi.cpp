@@ -210,9 +210,12 @@ namespace PDI {
     return send_byte(0x010001CBUL, 1);        /* 0x01CA: NVMCTRL_CTRLA */
   }
 
-  bool nvm_wait (void) {
-    do { recv_byte(0x010001CFUL); } while (RXDATA & 0xC0); /* 0x01CF: NVMCTRL_STATUS */
-    return true;
+  /* RXDATA is left with the last NVMCTRL_STATUS read. */
+  size_t nvm_wait (void) {
+    PERF_START(_t);
+    do { USB::yield(); recv_byte(0x010001CFUL); } while (RXDATA & 0xC0); /* 0x01CF: NVMCTRL_STATUS */
+    PERF_END(_t, nvm_wait);
+    return 1;
   }
 
   size_t erase_memory (void) {
@@ -245,6 +248,8 @@ namespace PDI {
     size_t  _wLength = packet.out.dwLength;
     size_t  _rspsize = 0;
     D1PRINTF(" L=%04X,A=%08lX,", _wLength, _dwAddr);
+    /* The erase-write of the last page may still be running. */
+    nvm_wait();
     if (!nvm_cmd(0x43)) return 0;
     if (_wLength == 1) {
       if (recv_byte(_dwAddr)) {
@@ -267,7 +272,7 @@ namespace PDI {
   }
 
   size_t write_memory (void) {
-    uint8_t _nvm_cmd = 0, _nvm_pclr = 0, _nvm_pset = 0;
+    uint8_t _nvm_cmd = 0, _nvm_pclr = 0, _nvm_pset = 0, _nvm_load = 0x01;
     uint8_t   m_type = packet.out.bMType;
     uint32_t _dwAddr = packet.out.dwAddr + get_mtype_offset(m_type);
     size_t  _wLength = packet.out.dwLength;
@@ -276,6 +281,7 @@ namespace PDI {
     _set_repeat[3] = 0x64;  /* ST PTR++ DATA1 */
     D1PRINTF(" L=%04X,A=%08lX,", _wLength, _dwAddr);
     nvm_wait();
+    uint8_t _status = RXDATA;
     if (m_type == 0xC0) {                                           /* APPCODE or FLASH */
       _nvm_cmd = 0x25; _nvm_pclr = 0x26; _nvm_pset = 0x23;
     }
@@ -283,7 +289,7 @@ namespace PDI {
       _nvm_cmd = 0x2D; _nvm_pclr = 0x26; _nvm_pset = 0x23;
     }
     else if (m_type == 0x22 || m_type == 0xB1 || m_type == 0xC4) {  /* EEPROM */
-      _nvm_cmd = 0x35; _nvm_pclr = 0x36; _nvm_pset = 0x33;
+      _nvm_cmd = 0x35; _nvm_pclr = 0x36; _nvm_pset = 0x33; _nvm_load = 0x02;
     }
     else if (m_type == 0xC5) {                                      /* USERSIG */
       _nvm_cmd = 0x1A; _nvm_pclr = 0x26; _nvm_pset = 0x23;
@@ -300,10 +306,11 @@ namespace PDI {
     }
 
     /* FLASH, BOOTCODE, APPCODE or EEPROM */
-    return (nvm_cmd(_nvm_pclr)
-     && nvm_cmdex()
-     && nvm_wait()
-     && nvm_cmd(_nvm_pset)
+    /* The page buffer is cleared only if FLOAD/EELOAD says it holds data.  */
+    /* The erase-write is left running while the host sends the next page; */
+    /* every following command starts with nvm_wait.                       */
+    if ((_status & _nvm_load) && !(nvm_cmd(_nvm_pclr) && nvm_cmdex() && nvm_wait())) return 0;
+    return (nvm_cmd(_nvm_pset)
      && send_bytes(_set_ptr32, sizeof(_set_ptr32))
      && send_bytes(_set_repeat, sizeof(_set_repeat))
      && send_bytes(&packet.out.memData[0], _wLength)
@@ -311,7 +318,7 @@ namespace PDI {
      && send_bytes(_set_ptr32, sizeof(_set_ptr32))
      && send(0x64)  /* ST */
      && send(0xFF)  /* dummy byte */
-     && nvm_wait());
+    );
   }
 
   // MARK: PDI Session
@@ -388,6 +395,8 @@ namespace PDI {
     }
     else if (_cmd == 0x11) {        /* CMD3_SIGN_OFF */
       D1PRINTF(" PDI_SIGN_OFF\r\n");
+      /* The last erase-write must complete before the reset. */
+      if (bit_is_set(PGCONF, PGCONF_PROG_bp)) Timeout::command(&nvm_wait);
       /* If UPDI control has failed, RSP3_OK is always returned. */
       _rspsize = Timeout::command(&disconnect);
       SYS::delay_100us();
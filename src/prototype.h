@@ -82,7 +82,13 @@
 #define USB_EP_STATUS_CLR(EPFIFO) _SFR_MEM8(&USB0_STATUS0_OUTCLR + ((EPFIFO) >> 2))
 #define USB_EP_STATUS_SET(EPFIFO) _SFR_MEM8(&USB0_STATUS0_OUTSET + ((EPFIFO) >> 2))
 
-#define USB_ENDPOINTS_MAX 4
+#if defined(CONFIG_VCP_SECOND)
+  #define USB_ENDPOINTS_MAX 7
+#elif defined(CONFIG_USB_VENDOR_BULK)
+  #define USB_ENDPOINTS_MAX 5
+#else
+  #define USB_ENDPOINTS_MAX 4
+#endif
 #define USB_CCI_INTERVAL  4
 
 /* In the internal representation of an endpoint number, */
@@ -94,6 +100,26 @@
 #define USB_EP_CCI  (0x28)  /* #1 CCI Communications-Control IN */
 #define USB_EP_CDO  (0x30)  /* #2 CDO Communications-Data OUT */
 #define USB_EP_CDI  (0x38)  /* #2 CDI Communications-Data IN */
+#define USB_EP_VBO  (0x40)  /* #3 Vendor Bulk OUT */
+#define USB_EP_VBI  (0x48)  /* #3 Vendor Bulk IN  */
+#define USB_EP_CCI2 (0x58)  /* #3+ CCI Communications-Control IN of the second VCP */
+#define USB_EP_CDO2 (0x60)  /* #4+ CDO Communications-Data OUT of the second VCP */
+#define USB_EP_CDI2 (0x68)  /* #4+ CDI Communications-Data IN of the second VCP */
+
+/* The second VCP follows the vendor bulk interface, if there is one. */
+#if defined(CONFIG_USB_VENDOR_BULK)
+  #define USB_IF_CDC2 4
+#else
+  #define USB_IF_CDC2 3
+#endif
+
+/* CDC-ACM requests taken by USB::yield, applied after the command. */
+#define DEFER_ENCODING  (1 << 0)
+#define DEFER_STATE     (1 << 1)
+#define DEFER_BREAK     (1 << 2)
+
+/* Vendor Bulk OUT is received in whole 64-byte packets directly into the JTAG packet. */
+#define USB_VBO_SIZE (JTAG_PACKET_SIZE & ~63)
 
 #define EP_REQ  USB_EP(USB_EP_REQ)
 #define EP_RES  USB_EP(USB_EP_RES)
@@ -102,6 +128,11 @@
 #define EP_CCI  USB_EP(USB_EP_CCI)
 #define EP_CDI  USB_EP(USB_EP_CDI)
 #define EP_CDO  USB_EP(USB_EP_CDO)
+#define EP_VBO  USB_EP(USB_EP_VBO)
+#define EP_VBI  USB_EP(USB_EP_VBI)
+#define EP_CCI2 USB_EP(USB_EP_CCI2)
+#define EP_CDO2 USB_EP(USB_EP_CDO2)
+#define EP_CDI2 USB_EP(USB_EP_CDI2)
 
 /* The last received data and state of UPDI are stored in the GP Register. */
 #define RXSTAT GPR_GPR0
@@ -139,6 +170,15 @@
   #define PGCONF_FAIL_bp  7         /* Initialization failed (timeout) */
   #define PGCONF_FAIL_bm  (1 << 7)
 
+/* The second VCP has no GP Register left, so its flags are kept in SRAM. */
+#define VCP2CONF _vcp2_conf
+  #define VCP2CONF_ENA_bp 0         /* VCP2 line coding accepted */
+  #define VCP2CONF_ENA_bm (1 << 0)
+  #define VCP2CONF_BRK_bp 1         /* VCP2-TxD BREAK transmission */
+  #define VCP2CONF_BRK_bm (1 << 1)
+  #define VCP2CONF_OPN_bp 2         /* VCP2-RxD open */
+  #define VCP2CONF_OPN_bm (1 << 2)
+
 /*
  * Global struct
  */
@@ -177,9 +217,22 @@ typedef struct {              /* DTE <-> DCE      */
   uint8_t  reserved;
 } PACKED SerialState_t;
 
+/*
+ * EDBG allows up to 15 fragments of 60 bytes.
+ * The full size is only used on parts with 8KB of SRAM or more.
+ * JTAG_MEMDATA_MAX is the largest READ/WRITE_MEMORY length that fits.
+ */
+#if (INTERNAL_SRAM_SIZE >= 8192)
+  #define JTAG_FRAGMENTS 15
+#else
+  #define JTAG_FRAGMENTS 9
+#endif
+#define JTAG_PACKET_SIZE (JTAG_FRAGMENTS * 60)
+#define JTAG_MEMDATA_MAX (JTAG_PACKET_SIZE - 28)
+
 typedef struct {
   union {
-    uint8_t rawData[540];
+    uint8_t rawData[JTAG_PACKET_SIZE];
     struct {
       uint8_t  token;             /* offset 0 */
       uint8_t  reserve1;
@@ -187,14 +240,14 @@ typedef struct {
       uint8_t  scope;
       uint8_t  cmd;
       union {
-        uint8_t data[534];
+        uint8_t data[JTAG_PACKET_SIZE - 6];
         struct {  /* CMD=21,23:CMD3_READ,WRITE_MEMORY */
           uint8_t  reserve2;
           uint8_t  bMType;
           uint32_t dwAddr;
           uint32_t dwLength;
           uint8_t  reserve3;
-          uint8_t  memData[513];  /* WRITE_MEMORY */
+          uint8_t  memData[JTAG_MEMDATA_MAX + 1]; /* WRITE_MEMORY */
         };
         struct {  /* CMD=1,2:CMD3_GET,SET_PARAMETER */
           uint8_t  reserve4;
@@ -244,7 +297,7 @@ typedef struct {
         };
       };
       union {
-        uint8_t  data[513];       /* READ_MEMORY */
+        uint8_t  data[JTAG_MEMDATA_MAX + 1];    /* READ_MEMORY */
         uint8_t  bStatus;
         uint16_t wValue;
         uint32_t dwValue;
@@ -282,6 +335,18 @@ typedef struct {
       uint8_t dap_data[64];   /* DAP IN/OUT */
       uint8_t cdo_data[64];
       uint8_t cdi_data[128];  /* 64x2 Double buffer */
+  #if defined(CONFIG_VCP_SECOND)
+      /* Past the end of res_data, so not overwritten by control responses. */
+      union {
+        uint8_t cci2_data[16];
+        struct {
+          Setup_Packet_t cci2_header;
+          uint16_t cci2_wValue;
+        };
+      };
+      uint8_t cdo2_data[64];
+      uint8_t cdi2_data[64];
+  #endif
     };
   };
 } PACKED EP_DATA_t;
@@ -384,11 +449,56 @@ typedef struct {
   size_t (*write_memory)(void);
 } PACKED Command_Table_t;
 
+/* Performance counters : LSB=1/32768 sec unless noted */
+typedef struct {
+  uint32_t edbg;              /* EDBG fragment reassembly */
+  uint32_t prog_init;         /* Command_Table callbacks */
+  uint32_t read_memory;
+  uint32_t erase_memory;
+  uint32_t write_memory;
+  uint32_t nvm_wait;          /* NVMCTRL busy polling */
+  uint32_t status_wait;       /* key_wait_* and sys_wait_* polling */
+  uint16_t timeouts;          /* LSB=1 */
+  uint16_t fallbacks;         /* LSB=1 */
+  uint32_t read_bytes[4];     /* FLASH, EEPROM, FUSE/LOCK/USERROW, OTHER */
+  uint32_t write_bytes[4];
+} PACKED Perf_Counter_t;
+
+#if defined(CONFIG_SYS_PERFCOUNT)
+  #define PERF_START(T)   uint16_t T = Timeout::ticks()
+  #define PERF_END(T,F)   (_perf.F += (uint16_t)(Timeout::ticks() - (T)))
+  #define PERF_COUNT(F,N) (_perf.F += (N))
+#else
+  #define PERF_START(T)
+  #define PERF_END(T,F)
+  #define PERF_COUNT(F,N)
+#endif
+
+#if defined(CONFIG_UPDI_GANG)
+  #define GANG_MERGE(M)   UPDI::gang_merge(M)
+#else
+  #define GANG_MERGE(M)
+#endif
+
 typedef struct {
   uint16_t wVidPid[2];
   uint32_t dwSerialNumber;
 } PACKED User_EEP_t;
 
+/* Standalone image store : the first 512-byte page is this header */
+#define STANDALONE_MAGIC 0x53413455UL   /* "U4AS" */
+typedef struct {
+  uint32_t dwMagic;     /* STANDALONE_MAGIC, written last by the host */
+  uint32_t dwLength;    /* bytes of the flash image following the header */
+  uint32_t dwCRC32;     /* of the flash image */
+  uint16_t wXclk;       /* LSB=1KHz 0:UPDI_CLK */
+  uint8_t  bHVCtrl;     /* PARM3_OPT_12V_UPDI_ENABLE */
+  uint8_t  reserve;
+  uint16_t wFuseMask;   /* bit n set : write abFuse[n] */
+  uint8_t  abFuse[16];  /* from fuses_base, after the verify */
+  UPDI_Device_Desc_t Desc;  /* PARM3_DEVICEDESC */
+} PACKED Standalone_Header_t;
+
 /*
  * Global workspace
  */
@@ -399,11 +509,21 @@ extern "C" {
     /* SYSTEM */
     extern jmp_buf TIMEOUT_CONTEXT;
     extern uint8_t _led_mode;
+    #if defined(CONFIG_SYS_PERFCOUNT)
+    extern Perf_Counter_t _perf;
+    #endif
 
     /* USB */
     extern EP_TABLE_t EP_TABLE;
     extern EP_DATA_t EP_MEM;
     extern Device_Desc_t Device_Descriptor;
+    extern uint8_t _res_piece[64];
+    extern uint16_t _res_index, _res_offset, _res_length;
+    extern uint8_t _res_pieces;
+    extern uint8_t _deferred_class;
+    extern LineEncoding_t _deferred_encoding;
+    extern uint8_t  _deferred_state;
+    extern uint16_t _deferred_break;
 
     /* Vertual Communication Port */
     #if defined(CONFIG_VCP_9BIT_SUPPORT)
@@ -418,6 +538,29 @@ extern "C" {
     extern uint8_t _set_config;
     extern volatile uint8_t _sof_count;
     extern uint8_t _set_serial_state;
+    extern uint8_t  _flush_latency;
+    extern uint8_t  _flush_override;
+    extern uint16_t _flush_term;
+    #if defined(CONFIG_VCP_RINGBUFFER)
+    extern uint8_t _vcp_rxbuf[VCP_RXBUF_SIZE];
+    extern uint8_t _vcp_txbuf[VCP_TXBUF_SIZE];
+    extern volatile uint16_t _vcp_rxhead, _vcp_rxtail;
+    extern volatile uint16_t _vcp_txhead, _vcp_txtail;
+    #endif
+    #if defined(CONFIG_VCP_SECOND)
+    extern LineEncoding_t _vcp2_encoding;
+    extern LineState_t _vcp2_state;
+    extern uint16_t _vcp2_break;
+    extern volatile uint8_t _vcp2_sof;
+    extern volatile uint8_t _vcp2_conf;
+    extern volatile uint8_t _vcp2_rxstat;
+    extern uint8_t _vcp2_serial_state;
+    extern uint8_t _vcp2_latency;
+    extern uint8_t _vcp2_rxbuf[VCP2_RXBUF_SIZE];
+    extern uint8_t _vcp2_txbuf[VCP2_TXBUF_SIZE];
+    extern volatile uint16_t _vcp2_rxhead, _vcp2_rxtail;
+    extern volatile uint16_t _vcp2_txhead, _vcp2_txtail;
+    #endif
 
     /* JTAG packet payload */
     extern JTAG_Packet_t packet;
@@ -425,6 +568,9 @@ extern "C" {
     extern uint8_t _packet_fragment;
     extern uint8_t _packet_chunks;
     extern uint8_t _packet_endfrag;
+    #if defined(CONFIG_USB_VENDOR_BULK)
+    extern uint8_t _bulk_state;
+    #endif
 
     /* JTAG parameter */
     extern uint32_t _before_page; /* before flash page section */
@@ -437,10 +583,19 @@ extern "C" {
     extern uint8_t _jtag_arch;    /* 5:ARCH */
     extern uint8_t _jtag_sess;    /* ?:SESSION */
     extern uint8_t _jtag_conn;    /* 8:CONN_UPDI */
+    extern uint8_t _jtag_keep;    /* LSB = 1sec */
+    extern uint16_t _keep_xclk;   /* LSB = 1KHz */
+    extern volatile uint16_t _keep_count; /* LSB = 1ms */
 
     /* UPDI parameter */
     extern Command_Table_t Command_Table;
     extern uint8_t _sib[32];
+    extern uint8_t _delta_map[64];
+    extern uint8_t _write_map[64];
+    extern uint16_t _erase_time;  /* LSB = 1ms */
+    #if defined(CONFIG_UPDI_GANG)
+    extern uint8_t _gang_state;
+    #endif
 
     /* TPI parameter */
     extern uint8_t _tpi_cmd_addr;
@@ -452,6 +607,10 @@ extern "C" {
 
 namespace JTAG {
   bool dap_command_check (void);
+  #if defined(CONFIG_USB_VENDOR_BULK)
+  bool bulk_command_check (void);
+  void complete_bulk_transactions (void);
+  #endif
   void jtag_scope_branch (void);
 };
 
@@ -472,6 +631,14 @@ namespace PDI {
   size_t jtag_scope_xmega (void);
 }
 
+#if defined(CONFIG_SYS_STANDALONE)
+namespace STANDALONE {
+  bool is_stored (void);
+  size_t store_page (void);
+  void run (void);
+};
+#endif
+
 namespace SYS {
   void setup (void);
   void LED_HeartBeat (void);
@@ -479,10 +646,18 @@ namespace SYS {
   void LED_Blink (void);
   void LED_Fast (void);
   void power_reset (bool _off = true, bool _on = true);
+  void power_settle (void);
+  #if defined(CONFIG_SYS_POWER_ADAPTIVE)
+  void power_discharge (void);
+  #endif
   void reset_enter (void);
   void reset_leave (void);
   void reboot (void);
   bool is_boundary_flash_page (uint32_t _dwAddr);
+  uint32_t crc32_update (uint32_t _crc, const uint8_t* _data, size_t _len);
+  #if defined(CONFIG_SYS_STANDALONE)
+  void flash_write_page (uint16_t _addr, const void* _data, size_t _len);
+  #endif
   uint16_t get_vdd (void);
   void hvc_enable (void);
   void hvc_leave (void);
@@ -499,6 +674,12 @@ namespace Timeout {
   void stop (void) __attribute__((used, naked, noinline));
   void extend (uint16_t _ms);
   size_t command (size_t (*func_p)(void), size_t (*fail_p)(void) = nullptr, uint16_t _ms = 800);
+  /* Time since Timeout::start, LSB=1/1024 sec. */
+  inline uint16_t elapsed (void) { return TCB0_CNT; }
+  #if defined(CONFIG_SYS_PERFCOUNT)
+  inline uint16_t ticks (void) { return RTC_CNT; }
+  void perf_bytes (uint8_t _mtype, size_t _length, bool _write);
+  #endif
 };
 
 namespace TPI {
@@ -512,6 +693,8 @@ namespace TPI {
 };
 
 namespace UPDI {
+  void set_baud (uint16_t _baud);
+  void transmit (const uint8_t _data);
   bool send_break (void);
   bool recv (void);
   bool recv_byte (void);
@@ -521,19 +704,44 @@ namespace UPDI {
   bool send_byte (uint32_t _dwAddr, uint8_t _data);
   bool send_bytes (const uint8_t* _data, size_t _len);
   bool is_ack (void);
+  bool repeat_block (uint32_t _dwAddr, uint8_t* _data, size_t _wLength, uint8_t _op);
   bool recv_bytes_block (uint32_t _dwAddr, size_t _wLength);
   bool recv_words_block (uint32_t _dwAddr, size_t _wLength);
   bool send_bytes_block (uint32_t _dwAddr, size_t _wLength);
   bool send_words_block (uint32_t _dwAddr, size_t _wLength);
   bool send_bytes_data (uint32_t _dwAddr, uint8_t* _data, size_t _wLength);
   bool send_bytes_block_slow (uint32_t _dwAddr, size_t _wLength);
+  bool send_bytes_block_paced (uint32_t _dwAddr, size_t _wLength);
   bool nvm_ctrl (uint8_t _nvmcmd);
+  void nvm_idle (void);
+  bool nvm_ctrl_change (uint8_t _nvmcmd, uint8_t (*_nvm_wait)(void));
+  bool ldcs_until (uint8_t _ldcs, uint16_t _start, uint16_t _limit);
+  bool erase_wait (void);
   bool chip_erase (void);
   bool write_userrow (void);
   size_t read_dummy (void);
+  size_t crc32_memory (void);
+  size_t scatter_memory (void);
+  uint16_t flash_page_size (void);
+  uint16_t write_span (void);
+  size_t crc32_pages (void);
+  size_t delta_compare (void);
+  bool is_delta_page (void);
+  bool is_written_page (bool _mark);
+  bool is_blank_page (void);
+  size_t timeout_fallback (void);
+  size_t timeout_abort (void);
   size_t connect (void);
   size_t disconnect (void);
   size_t enter_progmode (void);
+  size_t sign_off (void);
+  size_t keep_resume (void);
+  void keep_expire (void);
+  #if defined(CONFIG_UPDI_GANG)
+  void gang_drop (void);
+  void gang_merge (uint8_t _mode);
+  void gang_recv (void);
+  #endif
   size_t jtag_scope_updi (void);
 };
 
@@ -548,13 +756,25 @@ namespace USART {
   void change_pdi (void);
   void set_line_encoding (LineEncoding_t* _buff);
   void set_line_state (uint8_t _line_state);
+  void set_flush_latency (void);
   LineEncoding_t& get_line_encoding (void);
   LineState_t get_line_state (void);
+  #if defined(CONFIG_VCP_SECOND)
+  void disable_vcp2 (void);
+  void change_vcp2 (void);
+  void set_line_encoding2 (LineEncoding_t* _buff);
+  #endif
 };
 
 namespace USB {
   bool is_ep_setup (void);
   bool is_not_dap (void);
+  #if defined(CONFIG_USB_VENDOR_BULK)
+  bool is_not_vbulk (void);
+  bool is_vbi_pending (void);
+  void ep_vbo_listen (void);
+  void ep_vbi_listen (void);
+  #endif
   void ep_dpi_pending (void);
   void ep_cdo_pending (void);
   void complete_dap_out (void);
@@ -563,10 +783,23 @@ namespace USB {
   void vcp_receiver (void);
   void vcp_receiver_9bit (void);
   void vcp_transceiver (void);
+  #if defined(CONFIG_VCP_RINGBUFFER)
+  void vcp_ring_clear (void);
+  void vcp_transmitter (void);
+  #endif
   void vcp_transceiver_9bit (void);
+  #if defined(CONFIG_VCP_SECOND)
+  void vcp2_clear (void);
+  void vcp2_receiver (void);
+  void vcp2_transmitter (void);
+  void vcp2_transceiver (void);
+  #endif
   void setup_device (bool _force = false);
+  void handling_sof (void);
   void handling_bus_events (void);
-  void handling_control_transactions (void);
+  void handling_control_transactions (bool _deferred = false);
+  void handling_deferred (void);
+  void yield (void);
 };
 
 // end of header
@@ -0,0 +1,167 @@
+/**
+ * @file standalone.cpp
+ * @author askn (K.Sato) multix.jp
+ * @brief UPDI4AVR-USB is a program writer for the AVR series, which are UPDI/TPI
+ *        type devices that connect via USB 2.0 Full-Speed. It also has VCP-UART
+ *        transfer function. It only works when installed on the AVR-DU series.
+ *        Recognized by standard drivers for Windows/macos/Linux and AVRDUDE>=7.2.
+ * @version 1.33.46+
+ * @date 2024-08-26
+ * @copyright Copyright (c) 2024 askn37 at github.com
+ * @link Product Potal : https://askn37.github.io/
+ *         MIT License : https://askn37.github.io/LICENSE.html
+ */
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "peripheral.h"     /* import Serial (Debug) */
+#include "configuration.h"
+#include "prototype.h"
+
+#if defined(CONFIG_SYS_STANDALONE)
+
+/*
+ * NOTE:
+ *
+ * The image store occupies the APPCODE section from STANDALONE_BASE.
+ * The first page is a Standalone_Header_t, followed by the flash image.
+ *
+ * The host writes the store with CMD3_VENDOR_STORE_IMAGE on the EDBG scope,
+ * one 512-byte page per command, and the header page last.
+ * The image length must be a multiple of the target flash page size.
+ *
+ * When SW0 is released without a USB host, the same JTAG3 commands
+ * that AVRDUDE would send are built here and run through the UPDI scope:
+ * SIGN_ON, ENTER_PROGMODE, ERASE, WRITE_MEMORY..., CRC32_MEMORY,
+ * the fuses, and SIGN_OFF. The result is shown on the LED.
+ */
+
+#define STANDALONE_SIZE ((uint32_t)PROGMEM_SIZE - STANDALONE_BASE)
+#define STANDALONE_DATA (STANDALONE_BASE + 512)
+
+namespace STANDALONE {
+
+  /* True if the header page has been written. */
+  bool is_stored (void) {
+    return pgm_read_dword(STANDALONE_BASE) == STANDALONE_MAGIC;
+  }
+
+  /*
+   * CMD3_VENDOR_STORE_IMAGE
+   * dwAddr=page aligned store offset, dwLength=1..512 bytes in memData.
+   */
+  size_t store_page (void) {
+    uint32_t _dwAddr = packet.out.dwAddr;
+    size_t  _wLength = packet.out.dwLength;
+    if ((_dwAddr & 511) || !_wLength || _wLength > 512
+      || _dwAddr + _wLength > STANDALONE_SIZE) return 0;
+    uint16_t _addr = STANDALONE_BASE + _dwAddr;
+    SYS::flash_write_page(_addr, &packet.out.memData[0], _wLength);
+    return memcmp_P(&packet.out.memData[0], (const void*)_addr, _wLength) == 0;
+  }
+
+  /* Issue one JTAG3 command on the UPDI scope. */
+  bool issue (uint8_t _cmd) {
+    packet.out.scope = 0x12;        /* SCOPE_AVR */
+    packet.out.cmd = _cmd;
+    size_t _rspsize = UPDI::jtag_scope_updi();
+    return _rspsize && (uint8_t)packet.in.res != 0xA0;  /* RSP3_FAILED */
+  }
+
+  /* The response overwrites the request fields, so they are set every time. */
+  bool memory (uint8_t _cmd, uint8_t _mtype, uint32_t _dwAddr, uint32_t _dwLength) {
+    packet.out.bMType = _mtype;
+    packet.out.dwAddr = _dwAddr;
+    packet.out.dwLength = _dwLength;
+    return issue(_cmd);
+  }
+
+  /* The header must describe an image that was stored completely. */
+  bool is_intact (const Standalone_Header_t& _h) {
+    uint16_t _psize = UPDI::flash_page_size();
+    uint32_t _dwLength = _h.dwLength;
+    if (!_dwLength || !_psize || _psize > 512 || (_dwLength % _psize)
+      || _dwLength > STANDALONE_SIZE - 512
+      || _dwLength > _h.Desc.flash_bytes) return false;
+    uint16_t _addr = STANDALONE_DATA;
+    uint32_t _crc = ~0UL;
+    while (_dwLength) {
+      size_t _wLength = _dwLength > 512 ? 512 : _dwLength;
+      wdt_reset();
+      memcpy_P(&packet.out.memData[0], (const void*)_addr, _wLength);
+      _crc = SYS::crc32_update(_crc, &packet.out.memData[0], _wLength);
+      _addr += _wLength;
+      _dwLength -= _wLength;
+    }
+    D1PRINTF(" STORE_CRC32=%08lX\r\n", ~_crc);
+    return ~_crc == _h.dwCRC32;
+  }
+
+  bool program (const Standalone_Header_t& _h) {
+    uint16_t _psize = UPDI::flash_page_size();
+
+    /* CMD3_SIGN_ON : the same state that AVRDUDE would set up. */
+    packet.out.bMType = _h.bHVCtrl;
+    _packet_length = 7;
+    if (!issue(0x10)) return false;
+
+    /* CMD3_ENTER_PROGMODE, CMD3_ERASE_MEMORY (chip erase) */
+    /* A locked device enters PROGMODE only after the chip erase. */
+    if (!issue(0x15)) return false;
+    packet.out.bEType = 0;
+    packet.out.dwPageAddr = 0;
+    if (!issue(0x20)) return false;
+    if (bit_is_clear(PGCONF, PGCONF_PROG_bp) && !issue(0x15)) return false;
+    if (bit_is_clear(PGCONF, PGCONF_PROG_bp)) return false;
+
+    /* CMD3_WRITE_MEMORY : MTYPE_FLASH_PAGE */
+    uint16_t _addr = STANDALONE_DATA;
+    for (uint32_t _off = 0; _off < _h.dwLength; _off += _psize) {
+      wdt_reset();
+      memcpy_P(&packet.out.memData[0], (const void*)_addr, _psize);
+      if (!memory(0x23, 0xB0, _off, _psize)) return false;
+      _addr += _psize;
+    }
+
+    /* CMD3_VENDOR_CRC32_MEMORY : verify before the fuses are changed. */
+    wdt_reset();
+    if (!memory(0x70, 0xB0, 0, _h.dwLength)
+      || packet.in.dwValue != _h.dwCRC32) return false;
+
+    /* CMD3_WRITE_MEMORY : MTYPE_FUSE_BITS */
+    for (uint8_t i = 0; i < sizeof(_h.abFuse); i++) {
+      if (!(_h.wFuseMask & (1U << i))) continue;
+      packet.out.memData[0] = _h.abFuse[i];
+      if (!memory(0x23, 0xB2, _h.Desc.fuses_base + i, 1)) return false;
+    }
+    return true;
+  }
+
+  void run (void) {
+    Standalone_Header_t _h;
+    memcpy_P(&_h, (const void*)STANDALONE_BASE, sizeof(_h));
+    memcpy(&Device_Descriptor, &_h.Desc, sizeof(_h.Desc));
+    D1PRINTF("<STANDALONE:%06lX>\r\n", _h.dwLength);
+    PGCONF = 0;
+    _jtag_keep = 0;
+    _jtag_hvctrl = _h.bHVCtrl;
+    _jtag_arch = 5;
+    _jtag_vpow = 1;
+    _vtarget = SYS::get_vdd();
+    _xclk = _xclk_bak = _h.wXclk ? _h.wXclk : UPDI_CLK;
+    SYS::LED_Fast();
+
+    bool _result = is_intact(_h) && program(_h);
+    issue(0x11);                    /* CMD3_SIGN_OFF */
+    D1PRINTF("<STANDALONE:%s>\r\n", _result ? "PASS" : "FAIL");
+
+    /* PASS is the heartbeat, FAIL keeps blinking until the next SW0. */
+    if (_result) SYS::LED_HeartBeat();
+    else SYS::LED_Blink();
+  }
+
+};
+
+#endif
+
+// end of code
@@ -209,6 +209,9 @@ namespace SYS {
     pinControlRegister(PIN_VCP_RXD)      = PORT_PULLUPEN_bm;
     pinControlRegister(PIN_PGM_TDAT)     = PORT_PULLUPEN_bm;
     pinControlRegister(PIN_PGM_TRST)     = PORT_PULLUPEN_bm;
+  #if defined(CONFIG_UPDI_GANG)
+    pinControlRegister(PIN_PGM_TDAT1)    = PORT_PULLUPEN_bm;
+  #endif
     pinControlRegister(PIN_SYS_SW0)      = PORT_PULLUPEN_bm | PORT_ISC_RISING_gc;
     pinControlRegister(PIN_HVC_CHGPUMP1) = PORT_INVEN_bm    | PORT_ISC_INPUT_DISABLE_gc;
     /* PDAT in/output is shared outside connection with TDAT */
@@ -265,6 +268,12 @@ namespace SYS {
     TCB1_CCMP  = TCB1_FLASH;
     TCB1_CTRLA = TCB_ENABLE_bm | TCB_CLKSEL_EVENT_gc;
 
+  #if defined(CONFIG_SYS_STANDALONE)
+    /*** CPUINT ***/
+    /* With a BOOT section, the vectors would be placed after it by default. */
+    _PROTECTED_WRITE(CPUINT_CTRLA, CPUINT_IVSEL_bm);
+  #endif
+
   }
 
   /*
@@ -338,6 +347,10 @@ namespace SYS {
     }
     if (_on) {
   #ifdef PIN_PGM_VPOWER
+    #if defined(CONFIG_SYS_POWER_ADAPTIVE)
+      if (_jtag_arch != 0x03) power_discharge();
+      else
+    #endif
       delay_125ms();  /* discharge duration */
       digitalWriteMacro(PIN_PGM_VPOWER, LOW);   /* VTG on */
       pinControlRegister(PIN_VCP_TXD)  |= PORT_PULLUPEN_bm;   /* internal shared TCLK */
@@ -354,6 +367,37 @@ namespace SYS {
     }
   }
 
+  /*
+   * Wait for the target rail after power_reset.
+   * An unpowered target clamps TDAT LOW, a powered one lets it be pulled HIGH.
+   * The fixed 2500us is the upper bound, and also the TRST pulse without VPW.
+   */
+  void power_settle (void) {
+  #if defined(CONFIG_SYS_POWER_ADAPTIVE) && defined(PIN_PGM_VPOWER)
+    uint8_t _stable = 0;
+    for (uint8_t _i = 250; _i; _i--) {
+      delay_micros(10);
+      if (!digitalReadMacro(PIN_PGM_TDAT)) _stable = 0;
+      else if (++_stable >= 10) return;
+    }
+  #else
+    delay_2500us();
+  #endif
+  }
+
+#if defined(CONFIG_SYS_POWER_ADAPTIVE)
+  /* With the pullups off, TDAT falls with the target rail. The USB is serviced every millisecond. */
+  void power_discharge (void) {
+    uint8_t _stable = 0;
+    for (uint8_t _i = 125; _i; _i--) {
+      delay_micros(1000);
+      USB::yield();
+      if (digitalReadMacro(PIN_PGM_TDAT)) _stable = 0;
+      else if (++_stable >= 10) return;
+    }
+  }
+#endif
+
   /*** Low level TDAT stream manipulation ***/
   /* UPDI commands are sent from TDAT using only TCA0 and bit manipulation, without switching USART. */
   /* 128kbps is the lowest limit that can be achieved with an 8-bit timer at 32MHz or less. */
@@ -410,6 +454,13 @@ namespace SYS {
       DFLUSH();
       if (bit_is_set(GPCONF, GPCONF_USB_bp))
         LED_HeartBeat();  /* The USB is ready. */
+  #if defined(CONFIG_SYS_STANDALONE)
+      else if (STANDALONE::is_stored()) {
+        /* HLD would otherwise request HV control on connect. */
+        bit_clear(GPCONF, GPCONF_HLD_bp);
+        STANDALONE::run();  /* No host, program from the stored image. */
+      }
+  #endif
       else if (!USB0_ADDR)
         reboot();         /* USB disconnected, System reboot. */
       else
@@ -445,6 +496,52 @@ namespace SYS {
     return _result;
   }
 
+  /*
+   * CRC32 (IEEE 802.3 reflected) running update
+   *
+   * Start with ~0 and invert the final value; the result is the same as crc32().
+   * Unlike the one-shot form, it can be folded over a region read in chunks.
+   */
+  uint32_t crc32_update (uint32_t _crc, const uint8_t* _data, size_t _len) {
+    while (_len--) {
+      _crc ^= *_data++;
+      for (uint8_t _i = 0; _i < 8; _i++) {
+        _crc = (_crc >> 1) ^ (0xEDB88320UL & -(_crc & 1));
+      }
+    }
+    return _crc;
+  }
+
+  #if defined(CONFIG_SYS_STANDALONE)
+  /*
+   * Erase and write one self flash page in APPCODE with SPM.
+   * This must be executed from the BOOT section.
+   * An odd trailing byte is padded with 0xFF.
+   */
+  void flash_write_page (uint16_t _addr, const void* _data, size_t _len) {
+    const uint8_t* _p = (const uint8_t*)_data;
+    wdt_reset();
+    loop_until_bit_is_clear(NVMCTRL_STATUS, NVMCTRL_FLBUSY_bp);
+    _PROTECTED_WRITE_SPM(NVMCTRL_CTRLA, NVMCTRL_CMD_FLPER_gc);
+    __asm__ __volatile__ ("spm" :: "z" (_addr));
+    loop_until_bit_is_clear(NVMCTRL_STATUS, NVMCTRL_FLBUSY_bp);
+    _PROTECTED_WRITE_SPM(NVMCTRL_CTRLA, NVMCTRL_CMD_NONE_gc);
+    _PROTECTED_WRITE_SPM(NVMCTRL_CTRLA, NVMCTRL_CMD_FLWR_gc);
+    for (size_t i = 0; i < _len; i += 2) {
+      uint16_t _word = _p[i] | ((i + 1 < _len ? _p[i + 1] : 0xFF) << 8);
+      __asm__ __volatile__ (
+        "mov r0, %A1 \n\t"
+        "mov r1, %B1 \n\t"
+        "spm         \n\t"
+        "clr r1      \n\t"
+        :: "z" (_addr + i), "r" (_word) : "r0"
+      );
+      loop_until_bit_is_clear(NVMCTRL_STATUS, NVMCTRL_FLBUSY_bp);
+    }
+    _PROTECTED_WRITE_SPM(NVMCTRL_CTRLA, NVMCTRL_CMD_NONE_gc);
+  }
+  #endif
+
   /*
    * Measure self operating voltage.
    *
@@ -507,8 +604,12 @@ namespace SYS {
     delay_micros(2500);
   }
 
+  /* The USB is serviced every millisecond. */
   void delay_125ms (void) {
-    delay_millis(125);
+    for (uint8_t _i = 125; _i; _i--) {
+      delay_micros(1000);
+      USB::yield();
+    }
   }
 
 };
@@ -28,6 +28,10 @@ namespace Timeout {
     EVSYS_USERTCB0COUNT = EVSYS_USER_CHANNEL0_gc; /* TCB0_CLK = 1024Hz */
     EVSYS_USERTCB1COUNT = EVSYS_USER_CHANNEL1_gc; /* TCB1_CLK = 32Hz   */
     RTC_PITCTRLA = RTC_PITEN_bm;
+  #if defined(CONFIG_SYS_PERFCOUNT)
+    /* The RTC counter itself is the free-running time base of the counters. */
+    RTC_CTRLA = RTC_PRESCALER_DIV1_gc | RTC_RTCEN_bm;
+  #endif
   }
 
   /*
@@ -82,13 +86,27 @@ namespace Timeout {
       }
       Timeout::stop();
       D1PRINTF("[TO]");
+      PERF_COUNT(timeouts, 1);
       if (!fail_p) break;
       wdt_reset();
+      PERF_COUNT(fallbacks, 1);
       if (!(*fail_p)()) break;
     }
     return _result;
   }
 
+#if defined(CONFIG_SYS_PERFCOUNT)
+  /*** Bytes moved are grouped by the JTAG3 memory type. ***/
+  void perf_bytes (uint8_t _mtype, size_t _length, bool _write) {
+    uint8_t _group = 3;
+    if (_mtype == 0xB0 || _mtype == 0xC0 || _mtype == 0xC1) _group = 0;         /* FLASH */
+    else if (_mtype == 0x22 || _mtype == 0xB1 || _mtype == 0xC4) _group = 1;    /* EEPROM */
+    else if (_mtype == 0xB2 || _mtype == 0xB3 || _mtype == 0xC5) _group = 2;    /* FUSE, LOCK, USERROW */
+    if (_write) _perf.write_bytes[_group] += _length;
+    else        _perf.read_bytes[_group]  += _length;
+  }
+#endif
+
 };
 
 /*
@@ -19,6 +19,8 @@
 #include "configuration.h"
 #include "prototype.h"
 
+#ifdef CONFIG_PGM_TPI_ENABLE
+
 /*
  * NOTE:
  *
@@ -34,6 +36,7 @@
 #define TCLK_IN portRegister(PIN_PGM_TCLK).IN
 #define TCLK_bp pinPosition(PIN_PGM_TCLK)
 #define TPI_GVAL 0x05
+#define TPI_SIN_CLK 28    /* TCLK of one SIN poll, echo and guard time included */
 
 #define pinLogicPush(PIN) openDrainWriteMacro(PIN, LOW)
 #define pinLogicOpen(PIN) openDrainWriteMacro(PIN, HIGH)
@@ -43,6 +46,9 @@ namespace TPI {
     0xE0, 0xFF, 0x88, 0xD8, 0xCD, 0x45, 0xAB, 0x89, 0x12
   };
 
+  /* TCLK to idle after a flash write before the first SIN poll, learned per session. */
+  static uint16_t _tpi_settle;
+
   // MARK: TPI Low level
 
   void idle_clock (const size_t clock) {
@@ -65,6 +71,27 @@ namespace TPI {
     return recv() && _data == RXDATA;
   }
 
+  bool send_bytes (const uint8_t* _data, size_t _len) {
+    /* Keep TXDATA full and check each loopback echo as it arrives. */
+    /* At most two characters are in flight, so the RX FIFO does not overflow. */
+    const uint8_t* _echo = _data;
+    size_t  _left = _len;
+    uint8_t _fly  = 0;
+    do {
+      if (_left && _fly < 2 && bit_is_set(USART0_STATUS, USART_DREIF_bp)) {
+        USART0_TXDATAL = *_data++;
+        --_left;
+        ++_fly;
+      }
+      if (bit_is_set(USART0_STATUS, USART_RXCIF_bp)) {
+        if (!recv() || *_echo++ != RXDATA) return false;
+        --_fly;
+        --_len;
+      }
+    } while (_len);
+    return true;
+  }
+
   /*** TPI control and CSS area command ***/
 
   bool get_sldcs (const uint8_t _addr) {
@@ -108,11 +135,32 @@ namespace TPI {
   // MARK: TPI NVM Control
 
   bool nvm_wait (void) {
+    PERF_START(_t);
     while (get_sin(0x62) && RXDATA);  /* NVMCSR_REG: IO=0x32 */
+    PERF_END(_t, nvm_wait);
     D2PRINTF("<CSR:%02X>\r\n", RXDATA);
     return true;
   }
 
+  /*
+   * Wait for a flash write without polling through most of it.
+   * The learned time only grows by the polls that were still needed,
+   * so it settles just below the write time of the chip in use.
+   */
+  bool nvm_settle (void) {
+    PERF_START(_t);
+    idle_clock(_tpi_settle);
+    uint8_t _polls = 0;
+    while (true) {
+      if (!get_sin(0x62)) return false; /* NVMCSR_REG: IO=0x32 */
+      if (!RXDATA) break;
+      ++_polls;
+    }
+    if (_polls && _tpi_settle < 4096) _tpi_settle += TPI_SIN_CLK * _polls;
+    PERF_END(_t, nvm_wait);
+    return true;
+  }
+
   bool nvm_ctrl (const uint8_t _nvmcmd) {
     return set_sout(0x63, _nvmcmd);   /* NVMCMD_REG: IO=0x33 */
   }
@@ -179,7 +227,7 @@ namespace TPI {
       *--_p = 0xFF;   /* NAND masked dummy bytes */
     }
     while (_wLength & (_tpi_chunks - 1)) {
-      *((uint8_t*)(_dwAddr + _wLength++)) = 0xFF;
+      _p[_wLength++] = 0xFF;
     }
     D2PRINTF(" FIXED_WRITE=%08X:%04X\r\n", _dwAddr, _wLength);
 
@@ -199,27 +247,20 @@ namespace TPI {
     }
 
     /* WRITE_PAGE */
+    /* SST *PR+ keeps the pointer and NVMCMD stays WORD_WRITE, */
+    /* so only the data words are streamed for each chunk.     */
+    D2PRINTF(" CODE_WRITE=%08X:%04X\r\n", _dwAddr, _wLength);
+    if (!(nvm_wait() && set_sstpr(_dwAddr) && nvm_ctrl(0x1D))) return 0;
+    uint8_t _sst[] = { 0x64, 0xFF, 0x64, 0xFF }; /* SST *PR+ */
     for (size_t _i = 0; _i < _wLength; _i += _tpi_chunks) {
-      D2PRINTF(" CODE_WRITE=%08X:%04X\r\n", _dwAddr, _tpi_chunks);
-      _result &= nvm_wait()
-              && set_sstpr(_dwAddr)
-              && nvm_ctrl(0x1D)
-              && set_sst(*_p++)
-              && set_sst(*_p++);
-      /* The 2-word or 4-word write model requires a 12-bit wait for each word written. */
-      if (_tpi_chunks >= 4) {
-        idle_clock(16);
-        _result &= set_sst(*_p++) && set_sst(*_p++);
-      }
-      if (_tpi_chunks == 8) {
-        idle_clock(16);
-        _result &= set_sst(*_p++) && set_sst(*_p++);
-        idle_clock(16);
-        _result &= set_sst(*_p++) && set_sst(*_p++);
+      for (uint8_t _w = 0; _w < _tpi_chunks; _w += 2) {
+        /* The 2-word or 4-word write model requires a 12-bit wait for each word written. */
+        if (_w) idle_clock(16);
+        _sst[1] = *_p++;
+        _sst[3] = *_p++;
+        if (!send_bytes(_sst, sizeof(_sst))) return 0;
       }
-      _result &= nvm_wait();
-      if (!_result) return 0;
-      _dwAddr += _tpi_chunks;
+      if (!nvm_settle()) return 0;
     }
     return nvm_ctrl(0x00);
   }
@@ -228,11 +269,12 @@ namespace TPI {
 
   size_t connect (void) {
     PGCONF = 0;
+    _tpi_settle = 0;
     USART::setup();
 
     pinLogicPush(PIN_PGM_TRST);
     SYS::power_reset();
-    SYS::delay_2500us();
+    SYS::power_settle();
 
     /* Called with `-xhvtpi` hvtpi_support */
     /* or SW0 holding start */
@@ -341,7 +383,7 @@ namespace TPI {
       pinLogicOpen(PIN_PGM_TCLK);
       pinLogicOpen(PIN_PGM_TRST);
       SYS::power_reset();
-      SYS::delay_2500us();
+      SYS::power_settle();
       PGCONF = 0;
       USART::setup();
       USART::change_vcp();
@@ -401,4 +443,6 @@ namespace TPI {
 
 };
 
+#endif
+
 // end of code
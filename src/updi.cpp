@@ -53,29 +53,105 @@ namespace UPDI {
     0x55, 0x6A, 0, 0, 0, 0  /* ST(0x60) PTR(0x08) ADDR3(0x02) */
   };
 
+  static uint8_t _set_ptr16[] = {
+    0x55, 0x69, 0, 0        /* ST(0x60) PTR(0x08) ADDR2(0x01) */
+  };
+
+  /* Where the previous PTR++ REPEAT left the UPDI pointer. ~0:unknown */
+  static uint32_t _ptr_cache = ~0UL;
+  static bool _ptr16;         /* NVMv0 uses the 16-bit pointer form */
+
+  /* The last command written to NVMCTRL_CTRLA. ~0:unknown */
+  /* While idle is set, the status was seen clear and no command was started since. */
+  static uint8_t _nvm_shadow = ~0;
+  static bool _nvm_idle;
+
+  inline void nvm_shadow_clear (void) {
+    _nvm_shadow = ~0;
+    _nvm_idle = false;
+  }
+
   static uint8_t _set_repeat[] = {
     0x55, 0xA0, 0x00, /* repeat */
     0x55, 0x04        /* LD,ST PTR++ DATA1,2 */
   };
 
+#if defined(CONFIG_UPDI_GANG)
+  static uint8_t _gang_merge; /* 0:strict 1:OR 2:AND */
+#endif
+
   // MARK: UPDI Low level
 
+  void set_baud (uint16_t _baud) {
+    USART0_BAUD = _baud;
+  #if defined(CONFIG_UPDI_GANG)
+    USART1_BAUD = _baud;
+  #endif
+  }
+
+  /* Both channels run at the same baud, so USART1 has room whenever USART0 does. */
+  void transmit (const uint8_t _data) {
+    USART0_TXDATAL = _data;
+  #if defined(CONFIG_UPDI_GANG)
+    if (_gang_state == 1) USART1_TXDATAL = _data;
+  #endif
+  }
+
+#if defined(CONFIG_UPDI_GANG)
+  // MARK: UPDI Gang channel
+
+  /* The second channel leaves the gang and is no longer driven. */
+  void gang_drop (void) {
+    D1PRINTF(" GANG_DROP=%02X:%02X\r\n", RXSTAT, RXDATA);
+    _gang_state = 2;
+    USART1_CTRLB = 0;
+  }
+
+  /*
+   * Status polls may legitimately differ between the targets in time.
+   * 1:OR merges them for wait-until-clear, 2:AND for wait-until-set.
+   * Otherwise every character must match that of channel 0.
+   */
+  void gang_merge (uint8_t _mode) {
+    _gang_merge = _mode;
+  }
+
+  /* Take the character of channel 1 that pairs with the one just received. */
+  void gang_recv (void) {
+    uint16_t _spin = ~0;
+    while (bit_is_clear(USART1_STATUS, USART_RXCIF_bp)) {
+      if (!--_spin) { gang_drop(); return; }
+    }
+    uint8_t _s = USART1_RXDATAH;
+    uint8_t _d = USART1_RXDATAL;
+    if (_s != RXSTAT) gang_drop();
+    else if (_gang_merge == 1) RXDATA |= _d;
+    else if (_gang_merge == 2) RXDATA &= _d;
+    else if (_d != RXDATA) gang_drop();
+  }
+#endif
+
   bool send_break (void) {
-    USART0_BAUD = USART0_BAUD + (USART0_BAUD >> 1);
+    _ptr_cache = ~0UL;
+    nvm_shadow_clear();
+    set_baud(USART0_BAUD + (USART0_BAUD >> 1));
     send(0x00);
-    USART0_BAUD = USART::calk_baud_khz(_xclk);
+    set_baud(USART::calk_baud_khz(_xclk));
     return true;
   }
 
   void long_break (void) {
-    USART0_BAUD = USART::calk_baud_khz(_xclk >> 2);
+    set_baud(USART::calk_baud_khz(_xclk >> 2));
     send(0x00);
-    USART0_BAUD = USART::calk_baud_khz(_xclk);
+    set_baud(USART::calk_baud_khz(_xclk));
   }
 
   bool recv (void) {
     do { RXSTAT = USART0_RXDATAH; } while (!RXSTAT);
     RXDATA = USART0_RXDATAL;
+  #if defined(CONFIG_UPDI_GANG)
+    if (_gang_state == 1) gang_recv();
+  #endif
     RXSTAT ^= 0x80;
     // D1PRINTF("(%02X:%02X)", RXSTAT, RXDATA);
     return RXSTAT == 0;
@@ -96,14 +172,29 @@ namespace UPDI {
   bool send (const uint8_t _data) {
     loop_until_bit_is_set(USART0_STATUS, USART_DREIF_bp);
     // D1PRINTF("\r\n[%02X]", _data);
-    USART0_TXDATAL = _data;
+    transmit(_data);
     return recv() && _data == RXDATA;
   }
 
   bool send_bytes (const uint8_t* _data, size_t _len) {
+    /* Keep TXDATA full and check each loopback echo as it arrives. */
+    /* At most two characters are in flight, so the RX FIFO does not overflow. */
+    const uint8_t* _echo = _data;
+    size_t  _left = _len;
+    uint8_t _fly  = 0;
     do {
-      if (!send(*_data++)) return false;
-    } while (--_len);
+      if (_left && _fly < 2 && bit_is_set(USART0_STATUS, USART_DREIF_bp)) {
+        transmit(*_data++);
+        --_left;
+        ++_fly;
+      }
+      if (bit_is_set(USART0_STATUS, USART_RXCIF_bp)) {
+        /* The first mismatch fails the whole block. */
+        if (!recv() || *_echo++ != RXDATA) return false;
+        --_fly;
+        --_len;
+      }
+    } while (_len);
     return true;
   }
 
@@ -134,6 +225,8 @@ namespace UPDI {
       0x55, 0xC8, 0x00, /* SYSRUN */
       0x55, 0xC3, 0x04  /* UPDIDIS */
     };
+    _ptr_cache = ~0UL;
+    nvm_shadow_clear();
     return send_bytes(_reset, _leave ? 9 : 6);
   }
 
@@ -147,8 +240,50 @@ namespace UPDI {
     return send_bytes(_clear_rsd, 3);
   }
 
+  /*
+   * Load the UPDI pointer, unless the previous block left it there.
+   * The cache is cleared first, so any failure or timeout leaves it unknown.
+   * The caller sets the new position once the whole block has completed.
+   */
+  bool set_ptr (uint32_t _dwAddr) {
+    bool _hit = _dwAddr == _ptr_cache;
+    _ptr_cache = ~0UL;
+    if (_hit) return true;
+    if (_ptr16 && _dwAddr <= 0xFFFF) {
+      _CAPS16(_set_ptr16[2])->word = _dwAddr;
+      return send_bytes(_set_ptr16, 4) && is_ack();
+    }
+    _CAPS32(_set_ptr24[2])->dword = _dwAddr;
+    return send_bytes(_set_ptr24, 5) && is_ack();
+  }
+
   // MARK: UPDI API
 
+  /*
+   * LD/ST PTR++ with REPEAT over any length.
+   * A REPEAT covers at most 256 units, so longer blocks are split.
+   * The pointer is loaded only once; stores run with RSD enabled.
+   */
+  bool repeat_block (uint32_t _dwAddr, uint8_t* _data, size_t _wLength, uint8_t _op) {
+    uint8_t _unit = (_op & 1) + 1;          /* DATA1 or DATA2 */
+    bool    _store = _op & 0x40;
+    if (_unit == 2) _wLength &= ~1;
+    if (!set_ptr(_dwAddr) || (_store && !set_rsd())) return false;
+    _set_repeat[4] = _op;
+    do {
+      size_t _len = _wLength > (_unit << 8) ? (_unit << 8) : _wLength;
+      _set_repeat[2] = (_len / _unit) - 1;
+      if (!send_bytes(_set_repeat, sizeof(_set_repeat))) return false;
+      if (!(_store ? send_bytes(_data, _len) : recv_bytes(_data, _len))) return false;
+      _dwAddr  += _len;
+      _data    += _len;
+      _wLength -= _len;
+    } while (_wLength);
+    if (_store && !clear_rsd()) return false;
+    _ptr_cache = _dwAddr;
+    return true;
+  }
+
   bool recv_bytes_block (uint32_t _dwAddr, size_t _wLength) {
     if (_wLength == 1) {
       if (recv_byte(_dwAddr)) {
@@ -157,52 +292,22 @@ namespace UPDI {
       }
       return false;
     }
-    _CAPS32(_set_ptr24[2])->dword = _dwAddr;
-    _set_repeat[2] = _wLength - 1;
-    _set_repeat[4] = 0x24;  /* LD PTR++ DATA1 */
-    return send_bytes(_set_ptr24, 5)
-      && is_ack()
-      && send_bytes(_set_repeat, sizeof(_set_repeat))
-      && recv_bytes(&packet.in.data[0], _wLength);
+    return repeat_block(_dwAddr, &packet.in.data[0], _wLength, 0x24);     /* LD PTR++ DATA1 */
   }
 
   bool recv_words_block (uint32_t _dwAddr, size_t _wLength) {
-    /* This function works in word units up to 256 words, */
-    /* and will round down any fractional words.          */
-    _CAPS32(_set_ptr24[2])->dword = _dwAddr;
-    _set_repeat[2] = (_wLength >> 1) - 1;
-    _set_repeat[4] = 0x25;  /* LD PTR++ DATA2 */
-    return send_bytes(_set_ptr24, 5)
-      && is_ack()
-      && send_bytes(_set_repeat, sizeof(_set_repeat))
-      && recv_bytes(&packet.in.data[0], _wLength & ~1);
+    /* This function works in word units and will round down any fractional words. */
+    return repeat_block(_dwAddr, &packet.in.data[0], _wLength, 0x25);     /* LD PTR++ DATA2 */
   }
 
   bool send_bytes_block (uint32_t _dwAddr, size_t _wLength) {
     if (_wLength == 1) return send_byte(_dwAddr, packet.out.memData[0]);
-    _CAPS32(_set_ptr24[2])->dword = _dwAddr;
-    _set_repeat[2] = _wLength - 1;
-    _set_repeat[4] = 0x64;  /* ST PTR++ DATA1 */
-    return send_bytes(_set_ptr24, 5)
-      && is_ack()
-      && set_rsd()
-      && send_bytes(_set_repeat, sizeof(_set_repeat))
-      && send_bytes(&packet.out.memData[0], _wLength)
-      && clear_rsd();
+    return repeat_block(_dwAddr, &packet.out.memData[0], _wLength, 0x64); /* ST PTR++ DATA1 */
   }
 
   bool send_words_block (uint32_t _dwAddr, size_t _wLength) {
-    /* This function works in word units up to 256 words, */
-    /* and will round down any fractional words.          */
-    _CAPS32(_set_ptr24[2])->dword = _dwAddr;
-    _set_repeat[2] = (_wLength >> 1) - 1;
-    _set_repeat[4] = 0x65;  /* ST PTR++ DATA2 */
-    return send_bytes(_set_ptr24, 5)
-      && is_ack()
-      && set_rsd()
-      && send_bytes(_set_repeat, sizeof(_set_repeat))
-      && send_bytes(&packet.out.memData[0], _wLength & ~1)
-      && clear_rsd();
+    /* This function works in word units and will round down any fractional words. */
+    return repeat_block(_dwAddr, &packet.out.memData[0], _wLength, 0x65); /* ST PTR++ DATA2 */
   }
 
   bool send_bytes_data (uint32_t _dwAddr, uint8_t* _data, size_t _wLength) {
@@ -217,8 +322,63 @@ namespace UPDI {
     return send_bytes_data(_dwAddr, &packet.out.memData[0], _wLength);
   }
 
+  /*
+   * ST PTR++ with REPEAT, but every unit waits for its ACK.
+   * The bus stalls while each NVM write runs, and the ACK follows it,
+   * so this is paced like STS per byte with far fewer characters.
+   * Words are used when both the address and length are even.
+   */
+  bool send_bytes_block_paced (uint32_t _dwAddr, size_t _wLength) {
+    const uint8_t* _data = &packet.out.memData[0];
+    uint8_t _unit = ((_dwAddr | _wLength) & 1) ? 1 : 2;
+    if (!set_ptr(_dwAddr)) return false;
+    _set_repeat[4] = 0x63 + _unit;          /* ST PTR++ DATA1,2 */
+    do {
+      size_t _len = _wLength > (_unit << 8) ? (_unit << 8) : _wLength;
+      _set_repeat[2] = (_len / _unit) - 1;
+      if (!send_bytes(_set_repeat, sizeof(_set_repeat))) return false;
+      for (size_t _i = _len; _i; _i -= _unit) {
+        if (!send_bytes(_data, _unit) || !is_ack()) return false;
+        _data += _unit;
+      }
+      _dwAddr  += _len;
+      _wLength -= _len;
+    } while (_wLength);
+    _ptr_cache = _dwAddr;
+    return true;
+  }
+
   bool nvm_ctrl (uint8_t _nvmcmd) {
-    return send_byte(0x1000, _nvmcmd);  /* NVMCTRL_CTRLA */
+    _ptr_cache = ~0UL;
+    _nvm_shadow = ~0;
+    /* NOCMD starts nothing, so it leaves the controller idle. */
+    if (_nvmcmd) _nvm_idle = false;
+    if (!send_byte(0x1000, _nvmcmd)) return false;  /* NVMCTRL_CTRLA */
+    _nvm_shadow = _nvmcmd;
+    return true;
+  }
+
+  /* Called by the NVM drivers when their status poll ends. */
+  void nvm_idle (void) { _nvm_idle = true; }
+
+  /*
+   * Change NVMCTRL_CTRLA through NOCMD, for NVMv2 and later.
+   * The status poll and the CTRLA read are skipped while the shadow is valid,
+   * so a driver can stay in one write mode across packets.
+   */
+  bool nvm_ctrl_change (uint8_t _nvmcmd, uint8_t (*_nvm_wait)(void)) {
+    if (!_nvm_idle) _nvm_wait();
+    /* The caller starts work in this mode, so idle holds only until its own poll. */
+    _nvm_idle = false;
+    if (_nvm_shadow == _nvmcmd) return true;
+    if (_nvm_shadow == (uint8_t)~0 && recv_byte(0x1000)) {
+      /* Unknown after a reset or timeout, so it is read back once. */
+      _nvm_shadow = RXDATA;
+      if (RXDATA == _nvmcmd) return true;
+    }
+    if (_nvm_shadow != 0x00 && !nvm_ctrl(0x00)) return false;
+    if (0 != _nvmcmd) return nvm_ctrl(_nvmcmd);
+    return true;
   }
 
   bool key_status (void) {
@@ -232,34 +392,54 @@ namespace UPDI {
   }
 
   bool key_wait_set (uint8_t _bit) {
+    PERF_START(_t);
+    GANG_MERGE(2);
     SYS::delay_55us();
     do {
+      USB::yield();
       key_status();
     } while (bit_is_clear(RXDATA, _bit));
+    GANG_MERGE(0);
+    PERF_END(_t, status_wait);
     return true;
   }
 
   bool key_wait_clear (uint8_t _bit) {
+    PERF_START(_t);
+    GANG_MERGE(1);
     SYS::delay_55us();
     do {
+      USB::yield();
       key_status();
     } while (bit_is_set(RXDATA, _bit));
+    GANG_MERGE(0);
+    PERF_END(_t, status_wait);
     return true;
   }
 
   bool sys_wait_set (uint8_t _bit) {
+    PERF_START(_t);
+    GANG_MERGE(2);
     SYS::delay_55us();
     do {
+      USB::yield();
       sys_status();
     } while (bit_is_clear(RXDATA, _bit));
+    GANG_MERGE(0);
+    PERF_END(_t, status_wait);
     return true;
   }
 
   bool sys_wait_clear (uint8_t _bit) {
+    PERF_START(_t);
+    GANG_MERGE(1);
     SYS::delay_55us();
     do {
+      USB::yield();
       sys_status();
     } while (bit_is_set(RXDATA, _bit));
+    GANG_MERGE(0);
+    PERF_END(_t, status_wait);
     return true;
   }
 
@@ -282,14 +462,60 @@ namespace UPDI {
     return sys_reset(false);
   }
 
+  /* LDCS with a deadline on the answer, so a silent target cannot hold the wait. */
+  bool ldcs_until (uint8_t _ldcs, uint16_t _start, uint16_t _limit) {
+    uint8_t _cmd[] = {0x55, _ldcs};
+    if (!send_bytes(_cmd, 2)) return false;
+    while (bit_is_clear(USART0_STATUS, USART_RXCIF_bp)) {
+      if ((uint16_t)(Timeout::elapsed() - _start) >= _limit) return false;
+    }
+    return recv();
+  }
+
+  /*
+   * Wait for the chip erase to finish, with a short backoff between polls.
+   * The UPDI may not answer while the erase runs, so failed reads are retried.
+   * It gives up after UPDI_ERASE_TIMEOUT, also when the target stops answering.
+   * It runs inside Timeout::command, so the time taken, polls included,
+   * is measured with TCB0.
+   */
+  bool erase_wait (void) {
+    const static uint8_t _settle[] = UPDI_ERASE_SETTLE;
+    const uint16_t _limit = UPDI_ERASE_TIMEOUT * 1024UL / 1000;  /* LSB=1/1024s */
+    uint8_t  _ver   = _sib[10] - '0';
+    uint8_t  _step  = 1;    /* LSB=100us */
+    uint16_t _start = Timeout::elapsed();
+    bool     _done  = false;
+    /* The minimum settle time of this NVM version comes first. */
+    if (_ver < sizeof(_settle)) {
+      for (uint16_t _i = _settle[_ver] * 10U; _i; _i--) SYS::delay_100us();
+    }
+    GANG_MERGE(1);
+    USART::drain();
+    do {
+      USB::yield();
+      if (ldcs_until(0x8B, _start, _limit) && bit_is_clear(RXDATA, 5)   /* RSTSYS */
+       && ldcs_until(0x87, _start, _limit) && bit_is_clear(RXDATA, 3)) {  /* CHIPERASE */
+        _done = true;
+        break;
+      }
+      for (uint8_t _i = _step; _i; _i--) SYS::delay_100us();
+      if (_step < 32) _step <<= 1;
+    } while ((uint16_t)(Timeout::elapsed() - _start) < _limit);
+    /* An answer that came too late is not left for the next command. */
+    if (!_done) USART::drain();
+    GANG_MERGE(0);
+    _erase_time = ((uint32_t)(uint16_t)(Timeout::elapsed() - _start) * 1000) >> 10;
+    D1PRINTF(" ERASE_TIME=%dms\r\n", _erase_time);
+    return _done;
+  }
+
   bool chip_erase (void) {
     D1PRINTF(" CHIP_ERASE");
     USART::drain();
     if (!set_erase_key()) return false;
     D1PRINTF(" WAIT");
-    SYS::delay_125ms();
-    SYS::delay_125ms();
-    USART::drain();
+    if (!erase_wait()) return false;
     sys_wait_clear(5);      /* wait clear RSTSYS */
     sys_wait_clear(0);      /* wait clear LOCKSTATUS */
     D1PRINTF(" <SYS:%02X>\r\n", RXDATA);
@@ -299,6 +525,8 @@ namespace UPDI {
       sys_wait_set(3);      /* wait set PROGSTART */
     }
     D1PRINTF(" PROGSTART=%02X\r\n", RXDATA);
+    memset(&_delta_map, 0, sizeof(_delta_map));
+    memset(&_write_map, 0, sizeof(_write_map));
     bit_set(PGCONF, PGCONF_ERSE_bp);
     bit_set(PGCONF, PGCONF_PROG_bp);
     return (*Command_Table.prog_init)();
@@ -358,17 +586,235 @@ namespace UPDI {
     return _wLength + 1;
   }
 
+  /*
+   * Fold a memory region through CRC32 on the writer side.
+   * The region is read in chunks of up to 512 bytes with the current NVM driver.
+   * Only the 4-byte result is returned to the host.
+   */
+  size_t crc32_memory (void) {
+    uint8_t   m_type = packet.out.bMType;
+    uint32_t _dwAddr = packet.out.dwAddr;
+    uint32_t _dwLength = packet.out.dwLength;
+    uint32_t _crc = ~0UL;
+    while (_dwLength) {
+      size_t _wLength = _dwLength > 512 ? 512 : _dwLength;
+      /* The previous read overwrites the request fields. */
+      packet.out.bMType = m_type;
+      packet.out.dwAddr = _dwAddr;
+      packet.out.dwLength = _wLength;
+      Timeout::start(400);
+      wdt_reset();
+      if (!(*Command_Table.read_memory)()) return 0;
+      _crc = SYS::crc32_update(_crc, &packet.in.data[0], _wLength);
+      _dwAddr += _wLength;
+      _dwLength -= _wLength;
+    }
+    D1PRINTF(" CRC32=%08lX\r\n", ~_crc);
+    packet.in.dwValue = ~_crc;
+    return 5;
+  }
+
+  /*
+   * Run a list of SRAM/IO accesses back to back.
+   * Each item in memData is bType(0:read 1:write), a 24-bit address,
+   * a 16-bit length, and for a write the data that follows.
+   * The read results are returned in order, packed in packet.in.data.
+   * The list is first moved to the tail of the packet,
+   * so the results growing from the head never overtake it.
+   */
+  size_t scatter_memory (void) {
+    size_t _wLength = packet.out.dwLength;
+    uint8_t* _list = &packet.rawData[JTAG_PACKET_SIZE - _wLength];
+    uint8_t* _end = &packet.rawData[JTAG_PACKET_SIZE];
+    uint8_t* _p;
+    size_t _rlen = 0;
+    memmove(_list, &packet.out.memData[0], _wLength);
+    /* The whole list is checked before the first access. */
+    for (_p = _list; _end - _p >= 6; _p += 6) {
+      size_t _len = _CAPS16(_p[4])->word;
+      if (!_len) return 0;
+      if (_p[0]) _p += _len;
+      else _rlen += _len;
+    }
+    if (_p != _end || _rlen + _wLength > JTAG_MEMDATA_MAX) return 0;
+    uint8_t* _data = &packet.in.data[0];
+    for (_p = _list; _p < _end;) {
+      uint32_t _dwAddr = _CAPS32(_p[0])->dword >> 8;  /* bType is the low byte */
+      size_t _len = _CAPS16(_p[4])->word;
+      bool _write = _p[0];
+      _p += 6;
+      if (_write) {
+        if (!(_len == 1 ? send_byte(_dwAddr, *_p)
+          : repeat_block(_dwAddr, _p, _len, 0x64))) return 0;  /* ST PTR++ DATA1 */
+        _p += _len;
+      }
+      else {
+        if (_len == 1) {
+          if (!recv_byte(_dwAddr)) return 0;
+          *_data = RXDATA;
+        }
+        else if (!repeat_block(_dwAddr, _data, _len, 0x24)) return 0;  /* LD PTR++ DATA1 */
+        _data += _len;
+      }
+    }
+    D1PRINTF(" SCATTER=%04X\r\n", _rlen);
+    return _rlen + 1;
+  }
+
+  uint16_t flash_page_size (void) {
+    return ((uint16_t)Device_Descriptor.UPDI.flash_page_size_msb << 8)
+                    + Device_Descriptor.UPDI.flash_page_size;
+  }
+
+  /*
+   * The longest flash WRITE_MEMORY the connected NVM driver takes.
+   * NVMv0/v3/v5 split a packet at the page boundaries by themselves,
+   * the others take one page at a time. 0:not connected
+   */
+  uint16_t write_span (void) {
+    uint16_t _psize = flash_page_size();
+    if (!_sib[0] || !_psize) return 0;
+    if (_sib[10] != '0' && _sib[10] != '3' && _sib[10] != '5') return _psize;
+    return _psize > JTAG_MEMDATA_MAX ? _psize : JTAG_MEMDATA_MAX - (JTAG_MEMDATA_MAX % _psize);
+  }
+
+  /*
+   * Compare flash pages against the CRC32 list sent by the host.
+   * Returns a bitmap where a set bit is a page that differs.
+   * Identical pages are remembered, and later writes to them are skipped.
+   */
+  size_t crc32_pages (void) {
+    uint32_t _dwAddr = packet.out.dwAddr;   /* page aligned flash offset */
+    uint8_t  _count  = packet.out.dwLength >> 2;
+    uint16_t _psize  = flash_page_size();
+    if (!_psize || _count > 112) return 0;
+    uint16_t _index  = _dwAddr / _psize;
+    uint8_t  _len    = _psize < 64 ? _psize : 64;
+    uint8_t  _bitmap[14] = {};
+    /* Move the CRC list to the end of the packet, away from the read buffer. */
+    uint32_t* _list = (uint32_t*)&packet.rawData[sizeof(packet.rawData) - (_count << 2)];
+    memmove(_list, &packet.out.memData[0], _count << 2);
+    _dwAddr += ((uint32_t)Device_Descriptor.UPDI.prog_base_msb << 16)
+                        + Device_Descriptor.UPDI.prog_base;
+    for (uint8_t _i = 0; _i < _count; _i++, _index++) {
+      uint32_t _crc = ~0UL;
+      Timeout::start(400);
+      wdt_reset();
+      for (uint16_t _j = 0; _j < _psize; _j += _len) {
+        if (!recv_bytes_block(_dwAddr, _len)) return 0;
+        _crc = SYS::crc32_update(_crc, &packet.in.data[0], _len);
+        _dwAddr += _len;
+      }
+      bool _same = ~_crc == _list[_i];
+      if (!_same) bit_set(_bitmap[_i >> 3], _i & 7);
+      if (_index < sizeof(_delta_map) * 8) {
+        if (_same) bit_set(_delta_map[_index >> 3], _index & 7);
+        else bit_clear(_delta_map[_index >> 3], _index & 7);
+      }
+    }
+    _count = (_count + 7) >> 3;
+    D1PRINTF(" DELTA=");
+    D1PRINTHEX(&_bitmap, _count);
+    memcpy(&packet.in.data[0], &_bitmap, _count);
+    return _count + 1;
+  }
+
+  /*
+   * True if any flash page of this write was written since the chip erase.
+   * A page beyond the map cannot be tracked, so the chip is no longer taken as erased.
+   * With _mark, the pages are recorded as written.
+   */
+  bool is_written_page (bool _mark) {
+    uint16_t _psize = flash_page_size();
+    if (!_psize) return true;
+    uint32_t _index = packet.out.dwAddr / _psize;
+    uint32_t _last  = (packet.out.dwAddr + packet.out.dwLength - 1) / _psize;
+    bool _result = false;
+    do {
+      if (_index >= sizeof(_write_map) * 8) {
+        if (_mark) bit_clear(PGCONF, PGCONF_ERSE_bp);
+        return true;
+      }
+      if (bit_is_set(_write_map[_index >> 3], _index & 7)) _result = true;
+      else if (_mark) bit_set(_write_map[_index >> 3], _index & 7);
+    } while (++_index <= _last);
+    return _result;
+  }
+
+  /*
+   * True if the chip is freshly erased, the pages are untouched since,
+   * and the flash data is all 0xFF.
+   * Such a page is acknowledged without touching the NVM controller.
+   * Any other write marks its pages, so a later blank write to them is not dropped.
+   */
+  bool is_blank_page (void) {
+    if (bit_is_clear(PGCONF, PGCONF_ERSE_bp)) return false;
+    const uint8_t* _data = &packet.out.memData[0];
+    size_t _len = packet.out.dwLength;
+    uint8_t _and = 0xFF;
+    if (!_len || _len > JTAG_MEMDATA_MAX) return false;
+    do { _and &= *_data++; } while (--_len && _and == 0xFF);
+    if (_and == 0xFF && !is_written_page(false)) return true;
+    is_written_page(true);
+    return false;
+  }
+
+  /* Compare the flash with memData. 1:identical 2:different */
+  size_t delta_compare (void) {
+    uint8_t  _buff[32];
+    uint8_t* _data = &packet.out.memData[0];
+    size_t _wLength = packet.out.dwLength;
+    uint32_t _dwAddr = packet.out.dwAddr
+      + ((uint32_t)Device_Descriptor.UPDI.prog_base_msb << 16)
+      + Device_Descriptor.UPDI.prog_base;
+    do {
+      size_t _len = _wLength > sizeof(_buff) ? sizeof(_buff) : _wLength;
+      if (!repeat_block(_dwAddr, _buff, _len, 0x24)) return 0;   /* LD PTR++ DATA1 */
+      if (memcmp(_buff, _data, _len)) return 2;
+      _dwAddr  += _len;
+      _data    += _len;
+      _wLength -= _len;
+    } while (_wLength);
+    return 1;
+  }
+
+  /*
+   * True if the write is confined to a flash page known to be identical.
+   * The map is only a hint, so the page is read back and must still match memData.
+   */
+  bool is_delta_page (void) {
+    if (packet.out.bMType != 0xB0) return false;   /* MTYPE_FLASH_PAGE */
+    uint32_t _dwAddr = packet.out.dwAddr;
+    uint16_t _psize  = flash_page_size();
+    if (!_psize || !packet.out.dwLength) return false;
+    uint32_t _index  = _dwAddr / _psize;
+    if (_index >= sizeof(_delta_map) * 8
+     || (_dwAddr % _psize) + packet.out.dwLength > _psize
+     || bit_is_clear(_delta_map[_index >> 3], _index & 7)) return false;
+    if (Timeout::command(&delta_compare, &timeout_abort, 400) == 1) return true;
+    bit_clear(_delta_map[_index >> 3], _index & 7);
+    return false;
+  }
+
   // MARK: UPDI Session
 
   size_t timeout_fallback (void) {
+    _ptr_cache = ~0UL;
+    nvm_shadow_clear();
     /* If a timeout occurs, the communication speed will be reduced. */
-    RXDATA = _xclk - 25;
-    if (RXDATA < 40) return 0;
-    _xclk = RXDATA;
+    /* An XCLK from `-B` can exceed 8 bits, so it is not staged in RXDATA. */
+    if (_xclk < 65) return 0;
+    _xclk -= 25;
     send_break();
     return clear_rsd();
   }
 
+  /* The link is recovered the same way, but the command is not retried. */
+  size_t timeout_abort (void) {
+    timeout_fallback();
+    return 0;
+  }
+
   /*
    * For UPDI communication, first set the following:
    * - Keep forced reset for wakeup
@@ -389,16 +835,23 @@ namespace UPDI {
     bool _hven = (_packet_length >= 7 && packet.out.bMType && _jtag_hvctrl)
               || bit_is_set(GPCONF, GPCONF_HLD_bp);
     _sib[0] = 0;
+    _ptr_cache = ~0UL;
+    nvm_shadow_clear();
     _before_page = -1L;
+    memset(&_delta_map, 0, sizeof(_delta_map));
     NVM::V1::setup();   /* default is dummy callback */
     USART::setup();
 
     /* If possible, perform a hardware reset of the device. */
     digitalWriteMacro(PIN_PGM_TDAT, LOW);
     digitalWriteMacro(PIN_PGM_TRST, LOW);
+  #if defined(CONFIG_UPDI_GANG)
+    digitalWriteMacro(PIN_PGM_TDAT1, LOW);
+    _gang_merge = 0;
+  #endif
     pinLogicPush(PIN_PGM_TRST);
     SYS::power_reset();
-    SYS::delay_2500us();
+    SYS::power_settle();
     pinLogicOpen(PIN_PGM_TRST);
 
     /* High-Voltage control */
@@ -424,12 +877,22 @@ namespace UPDI {
 
     /* In most cases, a 2.5 ms LOW signal is sufficient to initiate UPDI activation. */
     pinLogicPush(PIN_PGM_TDAT);
+  #if defined(CONFIG_UPDI_GANG)
+    pinLogicPush(PIN_PGM_TDAT1);
+  #endif
     SYS::delay_2500us();
     pinLogicOpen(PIN_PGM_TDAT);
+  #if defined(CONFIG_UPDI_GANG)
+    pinLogicOpen(PIN_PGM_TDAT1);
+  #endif
 
     /* When UPDI is activated, it becomes a HIGH signal. */
     while (!digitalReadMacro(PIN_PGM_TDAT));
     USART::change_updi();
+  #if defined(CONFIG_UPDI_GANG)
+    /* Channel 1 follows in lockstep until its first mismatch. */
+    _gang_state = 1;
+  #endif
 
     /* It will send a series of commands and check the response. */
     /* If the response is invalid, it will send a BREAK character and try again. */
@@ -437,6 +900,7 @@ namespace UPDI {
     while (!(send_bytes(_init, sizeof(_init)) && recv() && (RXDATA == UPDI_CTRLAV))) {
       send_break();
       send_break();
+      USB::yield();
     }
 
     /* Read the SIB from the ACC. */
@@ -444,6 +908,7 @@ namespace UPDI {
     if (send_bytes(_sib256, sizeof(_sib256)) && recv_bytes(_sib, 32)) {
       size_t _result = 0;
       D1PRINTF(" NVM:%02X,SIB=\"%s\"\r\n", _sib[10], _sib);
+      _ptr16 = _sib[10] == '0';
       /* Depending on the SIB, different low-level methods are executed. */
       if      (_sib[10] == '5') _result = NVM::V5::setup();
       else if (_sib[10] == '4') _result = NVM::V4::setup();
@@ -476,7 +941,9 @@ namespace UPDI {
     /* A locked device does not have LOCKSTATUS cleared. */
     if (key_wait_clear(4) && sys_status() && bit_is_clear(RXDATA, 0)) {
       bit_set(PGCONF, PGCONF_PROG_bp);
+      PERF_START(_t);
       (*Command_Table.prog_init)();
+      PERF_END(_t, prog_init);
     }
     D1PRINTF("%02X\r\n", RXDATA);
 
@@ -484,6 +951,54 @@ namespace UPDI {
     return 1;
   }
 
+  // MARK: UPDI Keep session
+
+  size_t sign_off (void) {
+    /* If UPDI control has failed, RSP3_OK is always returned. */
+    size_t _result = bit_is_set(PGCONF, PGCONF_UPDI_bp) ? Timeout::command(&disconnect) : 1;
+    memset(&_delta_map, 0, sizeof(_delta_map));
+    SYS::delay_100us();
+    USART::setup();
+    pinLogicPush(PIN_PGM_TRST);
+    SYS::power_reset();
+    SYS::power_settle();
+    pinLogicOpen(PIN_PGM_TRST);
+    PGCONF = 0;
+    USART::change_vcp();
+    return _result;
+  }
+
+  /*
+   * Resume a session kept after SIGN_OFF.
+   * If the SIB still matches, reset and key entry are skipped.
+   */
+  size_t keep_resume (void) {
+    const static uint8_t _sib256[] = {
+      0x55, 0xE6        /* SIB 256bits */
+    };
+    uint8_t _buff[32];
+    _keep_count = 0;
+    _xclk = _keep_xclk;
+    set_baud(USART::calk_baud_khz(_xclk));
+    /* The application may have rewritten its flash in the meantime. */
+    memset(&_delta_map, 0, sizeof(_delta_map));
+    if (bit_is_set(PGCONF, PGCONF_PROG_bp)
+     && send_bytes(_sib256, sizeof(_sib256)) && recv_bytes(_buff, 32)
+     && !memcmp(_buff, _sib, 32)) {
+      D1PRINTF(" RESUME=%d\r\n", _xclk);
+      memcpy(&packet.in.data[0], _sib[0] == ' ' ? &_sib[4] : &_sib[0], 4);
+      return 5;
+    }
+    return 0;
+  }
+
+  void keep_expire (void) {
+    D1PRINTF("<KEEP_EXPIRE>\r\n");
+    _keep_count = 0;
+    _xclk = _keep_xclk;
+    sign_off();
+  }
+
   // MARK: JTAG SCOPE
 
   /* ARCH=UPDI scope Provides functionality. */
@@ -492,6 +1007,14 @@ namespace UPDI {
     uint8_t _cmd = packet.out.cmd;
     if (_cmd == 0x10) {             /* CMD3_SIGN_ON */
       D1PRINTF(" UPDI_SIGN_ON=EXT:%02X\r\n", packet.out.bMType);
+      /* A session kept with the same SIB is taken over as is. */
+      if (_keep_count) {
+        if ((_rspsize = Timeout::command(&keep_resume, nullptr, 20))) {
+          packet.in.res = 0x84;     /* RSP3_DATA */
+          return _rspsize;
+        }
+        keep_expire();
+      }
       _xclk = _xclk_bak;
       while (!(_rspsize = Timeout::command(&connect, nullptr, 150))) _xclk -= 25;
       /* If it fails here, it is expected to try again, giving it a chance at HV control. */
@@ -500,16 +1023,14 @@ namespace UPDI {
     }
     else if (_cmd == 0x11) {        /* CMD3_SIGN_OFF */
       D1PRINTF(" UPDI_SIGN_OFF\r\n");
-      /* If UPDI control has failed, RSP3_OK is always returned. */
-      _rspsize = bit_is_set(PGCONF, PGCONF_UPDI_bp) ? Timeout::command(&disconnect) : 1;
-      SYS::delay_100us();
-      USART::setup();
-      pinLogicPush(PIN_PGM_TRST);
-      SYS::power_reset();
-      SYS::delay_2500us();
-      pinLogicOpen(PIN_PGM_TRST);
-      PGCONF = 0;
-      USART::change_vcp();
+      if (_jtag_keep && bit_is_set(PGCONF, PGCONF_PROG_bp)) {
+        /* The target is left in PROGMODE and the VCP stays off until it expires. */
+        D1PRINTF(" KEEP=%d\r\n", _jtag_keep);
+        _keep_xclk = _xclk;
+        _keep_count = _jtag_keep * 1000U + 1;
+        _rspsize = 1;
+      }
+      else _rspsize = sign_off();
     }
     else if (_cmd == 0x15) {        /* CMD3_ENTER_PROGMODE */
       D1PRINTF(" UPDI_ENTER_PROG\r\n");
@@ -528,21 +1049,42 @@ namespace UPDI {
     else if (_cmd == 0x20) {        /* CMD3_ERASE_MEMORY */
       D1PRINTF(" UPDI_ERASE=%02X:%06lX\r\n",
         packet.out.bEType, packet.out.dwPageAddr);
+      memset(&_delta_map, 0, sizeof(_delta_map));
+      PERF_START(_t);
       _rspsize = Timeout::command(Command_Table.erase_memory, &timeout_fallback);
+      PERF_END(_t, erase_memory);
+      /* A failed erase may stop anywhere, so CTRLA and the status are unknown. */
+      if (!_rspsize) nvm_shadow_clear();
+    }
+  #if defined(CONFIG_UPDI_GANG)
+    else if (_cmd == 0x72) {        /* CMD3_VENDOR_GANG_STATUS */
+      /* bit0:channel 0 connected, bit1:channel 1 still in lockstep */
+      D1PRINTF(" UPDI_GANG=%02X\r\n", _gang_state);
+      packet.in.data[0] = (bit_is_set(PGCONF, PGCONF_UPDI_bp) ? 1 : 0)
+                        | (_gang_state == 1 ? 2 : 0);
+      packet.in.res = 0x184;        /* RSP3_DATA */
+      return 2;
     }
+  #endif
     else if (bit_is_clear(PGCONF, PGCONF_UPDI_bp)) { /* empty */ }
     else if (_cmd == 0x21) {        /* CMD3_READ_MEMORY */
       D1PRINTF(" UPDI_READ=%02X:%06lX:%04X\r\n", packet.out.bMType,
         packet.out.dwAddr, (size_t)packet.out.dwLength);
       uint8_t m_type = packet.out.bMType;
       size_t _wLength = packet.out.dwLength;
-      if (m_type == 0xD3) {         /* MTYPE_SIB */
+      if (_wLength > JTAG_MEMDATA_MAX) { /* It does not fit in the response. */ }
+      else if (m_type == 0xD3) {    /* MTYPE_SIB */
         /* The SIB request occurs before ENTER_PROGMODE. */
         memcpy(&packet.in.data[(uint8_t)packet.out.dwAddr & 31], &_sib, ((_wLength - 1) & 31) + 1);
         _rspsize = _wLength + 1;
       }
       else if (bit_is_set(PGCONF, PGCONF_PROG_bp)) {
+        PERF_START(_t);
         _rspsize = Timeout::command(Command_Table.read_memory, &timeout_fallback, 400);
+        PERF_END(_t, read_memory);
+  #if defined(CONFIG_SYS_PERFCOUNT)
+        if (_rspsize) Timeout::perf_bytes(m_type, _wLength, false);
+  #endif
       }
       /* If not in PROGMODE, respond with a dummy. */
       /* A dummy SIG will be returned for locked devices. */
@@ -551,10 +1093,51 @@ namespace UPDI {
       packet.in.res = _rspsize ? 0x184 : 0xA0;  /* RSP3_DATA : RSP3_FAILED */
       return _rspsize;
     }
+    else if (_cmd == 0x70) {        /* CMD3_VENDOR_CRC32_MEMORY */
+      /* Same fields as CMD3_READ_MEMORY, but any length is accepted. */
+      D1PRINTF(" UPDI_CRC32=%02X:%06lX:%06lX\r\n", packet.out.bMType,
+        packet.out.dwAddr, packet.out.dwLength);
+      if (bit_is_set(PGCONF, PGCONF_PROG_bp)) {
+        _rspsize = Timeout::command(&crc32_memory, nullptr, 400);
+      }
+      packet.in.res = _rspsize ? 0x184 : 0xA0;  /* RSP3_DATA : RSP3_FAILED */
+      return _rspsize;
+    }
+    else if (_cmd == 0x71) {        /* CMD3_VENDOR_CRC32_PAGES */
+      /* dwAddr=first page offset, dwLength=bytes of the CRC32 list in memData. */
+      D1PRINTF(" UPDI_DELTA=%06lX:%04X\r\n", packet.out.dwAddr, (size_t)packet.out.dwLength);
+      if (bit_is_set(PGCONF, PGCONF_PROG_bp)) {
+        _rspsize = Timeout::command(&crc32_pages, nullptr, 400);
+      }
+      packet.in.res = _rspsize ? 0x184 : 0xA0;  /* RSP3_DATA : RSP3_FAILED */
+      return _rspsize;
+    }
+    else if (_cmd == 0x73) {        /* CMD3_VENDOR_SCATTER_MEMORY */
+      /* dwLength=bytes of the item list in memData. PROGMODE is not required. */
+      /* The results overwrite the request, so a timeout is not retried. */
+      D1PRINTF(" UPDI_SCATTER=%04X\r\n", (size_t)packet.out.dwLength);
+      if (packet.out.dwLength && packet.out.dwLength <= JTAG_MEMDATA_MAX) {
+        _rspsize = Timeout::command(&scatter_memory, &timeout_abort);
+      }
+      packet.in.res = _rspsize ? 0x184 : 0xA0;  /* RSP3_DATA : RSP3_FAILED */
+      return _rspsize;
+    }
     else if (_cmd == 0x23) {        /* CMD3_WRITE_MEMORY */
       D1PRINTF(" UPDI_WRITE=%02X:%06lX:%04X\r\n", packet.out.bMType,
         packet.out.dwAddr, (size_t)packet.out.dwLength);
-      _rspsize = Timeout::command(Command_Table.write_memory, &timeout_fallback);
+      /* A write through the flash alias is not tracked in _write_map. */
+      if (packet.out.bMType == 0xC0) bit_clear(PGCONF, PGCONF_ERSE_bp);
+      /* Pages found identical by CMD3_VENDOR_CRC32_PAGES are not erased or written. */
+      if (is_delta_page()) _rspsize = 1;
+      else {
+        PERF_START(_t);
+        _rspsize = Timeout::command(Command_Table.write_memory, &timeout_fallback);
+        PERF_END(_t, write_memory);
+        if (!_rspsize) nvm_shadow_clear();
+  #if defined(CONFIG_SYS_PERFCOUNT)
+        if (_rspsize) Timeout::perf_bytes(packet.out.bMType, packet.out.dwLength, true);
+  #endif
+      }
     }
     packet.in.res = _rspsize ? 0x80 : 0xA0;     /* RSP3_OK : RSP3_FAILED */
     return _rspsize;
@@ -30,6 +30,11 @@ namespace USART {
     pinLogicOpen(PIN_PGM_TDAT);
     pinLogicOpen(PIN_PGM_TRST);
     pinLogicOpen(PIN_PGM_TCLK);
+  #if defined(CONFIG_UPDI_GANG)
+    USART1_CTRLB = 0;
+    USART1_CTRLA = 0;
+    pinLogicOpen(PIN_PGM_TDAT1);
+  #endif
   #if CONFIG_PGM_TYPE == 0
     if (_jtag_arch == 3) {
       pinLogicPush(PIN_PGM_PDAT);
@@ -65,6 +70,14 @@ namespace USART {
           "LDS R0, 0x0800\n"  /* drop USART0_RXDATAL */
         );
       }
+  #if defined(CONFIG_UPDI_GANG)
+      if (bit_is_set(USART1_STATUS, USART_RXCIF_bp)) {
+        __asm__ __volatile__ (
+          "LDS R0, 0x0821\n"  /* drop USART1_RXDATAH */
+          "LDS R0, 0x0820\n"  /* drop USART1_RXDATAL */
+        );
+      }
+  #endif
     } while (--_delay);
   }
 
@@ -101,6 +114,14 @@ namespace USART {
       /* Without it, an additional delay is required before sending a byte. */
       USART0_CTRLA = USART_LBME_bm | USART_RS485_INT_gc;
       USART0_CTRLB = USART_RXEN_bm | USART_TXEN_bm | USART_ODME_bm;
+  #if defined(CONFIG_UPDI_GANG)
+      /* The second channel uses the same frame format on USART1. */
+      USART1_STATUS = USART_DREIF_bm;
+      USART1_BAUD  = USART0_BAUD;
+      USART1_CTRLC = USART0_CTRLC;
+      USART1_CTRLA = USART0_CTRLA;
+      USART1_CTRLB = USART0_CTRLB;
+  #endif
       D1PRINTF(" USART=UPDI XCLK=%d BAUD=%04X\r\n", _xclk, USART0_BAUD);
     }
   }
@@ -183,6 +204,7 @@ namespace USART {
         bit_set(GPCONF, GPCONF_VCP_bp);
       }
       D1PRINTF(" USART=VCP\r\n");
+      set_flush_latency();
       drain();
     }
     else {
@@ -205,6 +227,23 @@ namespace USART {
     change_vcp();
   }
 
+  /*** A partial VCP-RxD packet is flushed after 16 character times of idle. ***/
+  /* The host can fix it with a vendor request instead. */
+  void set_flush_latency (void) {
+    uint8_t _ms = _flush_override;
+    uint32_t _baud = _set_line_encoding.dwDTERate;
+    if (_ms == 0 && _baud) {
+      /* START + DATA + PARITY + STOP */
+      uint16_t _bits = _set_line_encoding.bDataBits + 2
+                     + (_set_line_encoding.bParityType ? 1 : 0)
+                     + (_set_line_encoding.bCharFormat ? 1 : 0);
+      uint32_t _t = (16000UL * _bits + _baud - 1) / _baud;
+      _ms = _t > 30 ? 30 : (_t < 1 ? 1 : _t);
+    }
+    _flush_latency = _ms ? _ms : 30;
+    D1PRINTF(" FLUSH=%d\r\n", _flush_latency);
+  }
+
   LineEncoding_t& get_line_encoding (void) {
     return _set_line_encoding;
   }
@@ -242,6 +281,74 @@ namespace USART {
     return _set_line_state;
   }
 
+  // MARK: VCP2
+
+#if defined(CONFIG_VCP_SECOND)
+  /*** Stop the second VCP and release its pins. ***/
+  void disable_vcp2 (void) {
+    if (USART1_CTRLB) {
+      /* Allow time to move USART1_TXDATA */
+      delay_micros(4);
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        USART1_CTRLB = 0;
+        USART1_CTRLA = 0;
+      }
+    }
+    pinControlRegister(PIN_VCP2_TXD) = PORT_PULLUPEN_bm;
+    pinControlRegister(PIN_VCP2_RXD) = PORT_PULLUPEN_bm;
+    pinLogicOpen(PIN_VCP2_TXD);
+    pinLogicOpen(PIN_VCP2_RXD);
+  }
+
+  /*** Activates the second VCP on USART1. ***/
+  /* 5 to 8 data bits only. Anything else leaves it stopped. */
+  void change_vcp2 (void) {
+    uint8_t _ctrlb = USART_RXEN_bm | USART_TXEN_bm | USART_ODME_bm;
+    uint32_t _rate = _vcp2_encoding.dwDTERate;
+    uint32_t _baud = _rate ? (((F_CPU * 8L) / _rate) + 1) >> 1 : 0;
+    uint8_t _bits = _vcp2_encoding.bDataBits - 5;
+    if (_baud < 96) {
+      _baud <<= 1;
+      _ctrlb |= USART_RXMODE_CLK2X_gc;
+    }
+    bit_clear(VCP2CONF, VCP2CONF_ENA_bp);
+    if (_baud < 0x10000UL && _baud >= 64 && _bits < 4) {
+      uint8_t _ctrlc = (uint8_t[]){
+        USART_PMODE_DISABLED_gc, USART_PMODE_ODD_gc, USART_PMODE_EVEN_gc, USART_PMODE_DISABLED_gc
+      }[_vcp2_encoding.bParityType & 3]
+      | (_vcp2_encoding.bCharFormat ? USART_SBMODE_2BIT_gc : USART_SBMODE_1BIT_gc)
+      | _bits; /* USART_CHSIZE_[5,6,7,8]BIT_gc */
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        USART1_STATUS = USART_DREIF_bm;
+        USART1_BAUD = (uint16_t)_baud;
+        USART1_CTRLC = _ctrlc;
+        USART1_CTRLA = USART_RXCIE_bm;
+        USART1_CTRLB = _ctrlb;
+        bit_set(VCP2CONF, VCP2CONF_ENA_bp);
+      }
+      /* The flush latency is 16 character times, as for the first VCP. */
+      uint16_t _frame = _vcp2_encoding.bDataBits + 2
+                      + (_vcp2_encoding.bParityType ? 1 : 0)
+                      + (_vcp2_encoding.bCharFormat ? 1 : 0);
+      uint32_t _t = (16000UL * _frame + _rate - 1) / _rate;
+      _vcp2_latency = _t > 30 ? 30 : (_t < 1 ? 1 : _t);
+      D1PRINTF(" USART=VCP2 BAUD=%04X FLUSH=%d\r\n", USART1_BAUD, _vcp2_latency);
+    }
+    else {
+      D1PRINTF(" VCP2=FAIL\r\n");
+    }
+  }
+
+  void set_line_encoding2 (LineEncoding_t* _buff) {
+    /* A port stopped by BREAK is restarted even with the same setting. */
+    if (0 == memcmp(&_vcp2_encoding, _buff, sizeof(LineEncoding_t))
+      && USART1_CTRLB) return;
+    disable_vcp2();
+    memcpy(&_vcp2_encoding, _buff, sizeof(LineEncoding_t));
+    change_vcp2();
+  }
+#endif
+
 };
 
 /*** CMSIS-DAP VCOM,VCP transceiver ***/
@@ -253,4 +360,20 @@ ISR(USART0_RXC_vect) {
 #endif
 }
 
+#if defined(CONFIG_VCP_RINGBUFFER)
+ISR(USART0_DRE_vect) {
+  USB::vcp_transmitter();
+}
+#endif
+
+#if defined(CONFIG_VCP_SECOND)
+ISR(USART1_RXC_vect) {
+  USB::vcp2_receiver();
+}
+
+ISR(USART1_DRE_vect) {
+  USB::vcp2_transmitter();
+}
+#endif
+
 // end of code
@@ -48,6 +48,9 @@ namespace USB {
   const wchar_t PROGMEM vstring[] = L"MultiX.jp OSSW/OSHW Prod.";
   const wchar_t PROGMEM mstring[] = L"UPDI4AVR-USB:AVR-DU:EDBG/CMSIS-DAP";
   const wchar_t PROGMEM istring[] = L"CDC-ACM/VCP";
+#if defined(CONFIG_VCP_SECOND)
+  const wchar_t PROGMEM istring2[] = L"CDC-ACM/VCP2";
+#endif
 
   const uint8_t PROGMEM device_descriptor[] = {
     /* This device descriptor contains the VID:PID, default is MCHP:CDC-ACM. */
@@ -61,7 +64,15 @@ namespace USB {
   const uint8_t PROGMEM current_descriptor[] = {
     /* This descriptor is almost identical to the Xplained Mini series. */
     /* It does not allow for an dWire gateway. */
+  #if defined(CONFIG_USB_VENDOR_BULK) && defined(CONFIG_VCP_SECOND)
+    0x09, 0x02, 0xC4, 0x00, 0x06, 0x01, 0x00, 0x80, 0x32, /* Information Set#6 */
+  #elif defined(CONFIG_VCP_SECOND)
+    0x09, 0x02, 0xAD, 0x00, 0x05, 0x01, 0x00, 0x80, 0x32, /* Information Set#5 (Dual CDC) */
+  #elif defined(CONFIG_USB_VENDOR_BULK)
+    0x09, 0x02, 0x82, 0x00, 0x04, 0x01, 0x00, 0x80, 0x32, /* Information Set#4 */
+  #else
     0x09, 0x02, 0x6B, 0x00, 0x03, 0x01, 0x00, 0x80, 0x32, /* Information Set#3 */
+  #endif
     0x09, 0x04, 0x00, 0x00, 0x02, 0x03, 0x00, 0x00, 0x00, /* Interface #0 HID  */
     0x09, 0x21, 0x11, 0x01, 0x00, 0x01, 0x22, 0x23, 0x00, /*   HID using       */
     0x07, 0x05, 0x02, 0x03, 0x40, 0x00, 0x01,             /*   EP_DPO_OUT 0x02 */
@@ -76,27 +87,24 @@ namespace USB {
     0x09, 0x04, 0x02, 0x00, 0x02, 0x0A, 0x00, 0x00, 0x00, /* Interface #2 Bulk */
     0x07, 0x05, 0x03, 0x02, 0x40, 0x00, 0x00,             /*   EP_CDO_OUT 0x03 */
     0x07, 0x05, 0x83, 0x02, 0x40, 0x00, 0x00,             /*   EP_CDI_IN  0x83 */
-  #ifdef _I_want_to_use_a_second_CDC_ACM_additional_
-    /*
-     * Examples for increasing the number of CDC-ACM interfaces on Windows and macos.
-     * Besides this, you need to extend the required endpoint implementation.
-     * You can add up to 6 sets.
-     * Linux? Basically no, probably only the first one will work.
-     *
-     * Please update the Information Descriptor as shown in the example.
-     *             ____  ____  ____
-     * 0x09, 0x02, 0xAD, 0x00, 0x05, 0x01, 0x00, 0x80, 0x32, // Information Set#5 (Dual CDC)
-    */
-    0x08, 0x0B, 0x03, 0x02, 0x02, 0x02, 0x01, 0x05,       /* CDC IAD    Str#5  */
-    0x09, 0x04, 0x03, 0x00, 0x01, 0x02, 0x02, 0x01, 0x00, /* Interface #3 CDC  */
+  #if defined(CONFIG_USB_VENDOR_BULK)
+    /* The same JTAG3 payloads as the HID, without the EDBG framing. */
+    0x09, 0x04, 0x03, 0x00, 0x02, 0xFF, 0x00, 0x00, 0x00, /* Interface #3 Vendor */
+    0x07, 0x05, 0x04, 0x02, 0x40, 0x00, 0x00,             /*   EP_VBO_OUT 0x04 */
+    0x07, 0x05, 0x84, 0x02, 0x40, 0x00, 0x00,             /*   EP_VBI_IN  0x84 */
+  #endif
+  #if defined(CONFIG_VCP_SECOND)
+    /* The second VCP on USART1. The interface numbers follow the vendor bulk. */
+    0x08, 0x0B, USB_IF_CDC2, 0x02, 0x02, 0x02, 0x01, 0x05,  /* CDC IAD    Str#5  */
+    0x09, 0x04, USB_IF_CDC2, 0x00, 0x01, 0x02, 0x02, 0x01, 0x00,  /* Interface #3+ CDC */
     0x05, 0x24, 0x00, 0x10, 0x01,                         /* Functional Header */
     0x04, 0x24, 0x02, 0x06,                               /* Functional ACM Capabilities  */
-    0x05, 0x24, 0x06, 0x03, 0x04,                         /* Functional UNION     #3 + #4 */
-    0x05, 0x24, 0x01, 0x03, 0x04,                         /* Functional CallManagement #4 */
-    0x07, 0x05, 0x84, 0x03, 0x10, 0x00, 0x05,             /*   EP_CCI_IN  0x84 */
-    0x09, 0x04, 0x04, 0x00, 0x02, 0x0A, 0x00, 0x00, 0x00, /* Interface #4 Bulk */
-    0x07, 0x05, 0x05, 0x02, 0x40, 0x00, 0x00,             /*   EP_CDO_OUT 0x05 */
-    0x07, 0x05, 0x85, 0x02, 0x40, 0x00, 0x00,             /*   EP_CDI_IN  0x85 */
+    0x05, 0x24, 0x06, USB_IF_CDC2, USB_IF_CDC2 + 1,       /* Functional UNION   #3+ + #4+ */
+    0x05, 0x24, 0x01, 0x03, USB_IF_CDC2 + 1,              /* Functional CallManagement #4+ */
+    0x07, 0x05, 0x85, 0x03, 0x10, 0x00, USB_CCI_INTERVAL, /*   EP_CCI2_IN 0x85 */
+    0x09, 0x04, USB_IF_CDC2 + 1, 0x00, 0x02, 0x0A, 0x00, 0x00, 0x00,  /* Interface #4+ Bulk */
+    0x07, 0x05, 0x06, 0x02, 0x40, 0x00, 0x00,             /*   EP_CDO2_OUT 0x06 */
+    0x07, 0x05, 0x86, 0x02, 0x40, 0x00, 0x00,             /*   EP_CDI2_IN  0x86 */
   #endif
   };
   const uint8_t PROGMEM report_descriptor[] = {
@@ -145,11 +153,46 @@ namespace USB {
           USB_TYPE_BULKINT_gc | USB_MULTIPKT_bm | USB_AZLP_bm | USB_TCDSBL_bm | USB_BUFSIZE_DEFAULT_BUF64_gc,
           0, (uint16_t)&EP_MEM.cdi_data, 0 },
       },
+  #if defined(CONFIG_USB_VENDOR_BULK)
+      { /* EP_VBO */
+        { 0,
+          USB_TYPE_BULKINT_gc | USB_MULTIPKT_bm               | USB_TCDSBL_bm | USB_BUFSIZE_DEFAULT_BUF64_gc,
+          0, (uint16_t)&packet.rawData, USB_VBO_SIZE },
+        /* EP_VBI */
+        { USB_BUSNAK_bm,
+          USB_TYPE_BULKINT_gc | USB_MULTIPKT_bm | USB_AZLP_bm | USB_TCDSBL_bm | USB_BUFSIZE_DEFAULT_BUF64_gc,
+          0, (uint16_t)&packet.rawData, 0 },
+      },
+  #elif defined(CONFIG_VCP_SECOND)
+      { /* EP4 not used */ },
+  #endif
+  #if defined(CONFIG_VCP_SECOND)
+      { /* EP_CCI2 */
+        { /* not used */ },
+        { 0,
+          USB_TYPE_BULKINT_gc | USB_MULTIPKT_bm | USB_AZLP_bm | USB_TCDSBL_bm | USB_BUFSIZE_DEFAULT_BUF16_gc,
+          0, (uint16_t)&EP_MEM.cci2_data, 0 },
+      },
+      { /* EP_CDO2 */
+        { 0,
+          USB_TYPE_BULKINT_gc                                 | USB_TCDSBL_bm | USB_BUFSIZE_DEFAULT_BUF64_gc,
+          0, (uint16_t)&EP_MEM.cdo2_data, 64 },
+        /* EP_CDI2 */
+        { USB_BUSNAK_bm,
+          USB_TYPE_BULKINT_gc | USB_MULTIPKT_bm | USB_AZLP_bm | USB_TCDSBL_bm | USB_BUFSIZE_DEFAULT_BUF64_gc,
+          0, (uint16_t)&EP_MEM.cdi2_data, 0 },
+      },
+  #endif
     },
     { /* FRAMENUM */ }
   };
 
-  size_t get_descriptor (uint8_t* _buffer, uint16_t _index) {
+  /*
+   * Copies bytes [_offset, _offset + _count) of a descriptor and returns its full size.
+   * The descriptors built in SRAM are shorter than 64 bytes,
+   * so they are always copied whole from offset 0.
+   */
+  size_t get_descriptor (uint8_t* _buffer, uint16_t _index, size_t _offset = 0, size_t _count = 0xFFFF) {
     uint8_t* _pgmem = 0;
     size_t   _size = 0;
     uint8_t  _type = _index >> 8;
@@ -191,6 +234,9 @@ namespace USB {
         case 0x0301: _pgmem = (uint8_t*)&vstring; _size = sizeof(vstring); break;
         case 0x0302: _pgmem = (uint8_t*)&mstring; _size = sizeof(mstring); break;
         case 0x0304: _pgmem = (uint8_t*)&istring; _size = sizeof(istring); break;
+  #if defined(CONFIG_VCP_SECOND)
+        case 0x0305: _pgmem = (uint8_t*)&istring2; _size = sizeof(istring2); break;
+  #endif
         // case 0x0303: _pgmem = (uint8_t*)&string3; _size = sizeof(string3); break;
         case 0x0303: {
           /*
@@ -214,12 +260,25 @@ namespace USB {
           return 22;
         }
       }
-      *_buffer++ = (uint8_t)_size;
-      *_buffer++ = 3;
-      if (_size) memcpy_P(_buffer, _pgmem, _size - 2);
-      return _size;
+      if (!_size) return 0;
+      if (_offset == 0) {
+        if (_count < 2) return _size;
+        *_buffer++ = (uint8_t)_size;
+        *_buffer++ = 3;
+        _count -= 2;
+      }
+      else _offset -= 2;
+      _size -= 2;
+      if (_offset < _size) {
+        size_t _rest = _size - _offset;
+        memcpy_P(_buffer, _pgmem + _offset, (_count > _rest) ? _rest : _count);
+      }
+      return _size + 2;
+    }
+    if (_offset < _size) {
+      size_t _rest = _size - _offset;
+      memcpy_P(_buffer, _pgmem + _offset, (_count > _rest) ? _rest : _count);
     }
-    if (_size) memcpy_P(_buffer, _pgmem, _size);
     return _size;
   }
 
@@ -249,8 +308,19 @@ namespace USB {
       _recv_count = 0;
       _set_config = 0;
       _sof_count = 0;
+      _res_pieces = 0;
+      _deferred_class = 0;
+  #if defined(CONFIG_USB_VENDOR_BULK)
+      _bulk_state = 0;
+  #endif
+  #if defined(CONFIG_VCP_RINGBUFFER)
+      vcp_ring_clear();
+  #endif
       memcpy_P(&EP_TABLE, &ep_init, sizeof(EP_TABLE_t));
       set_cci_data(0x00);
+  #if defined(CONFIG_VCP_SECOND)
+      vcp2_clear();
+  #endif
       USB0_CTRLA = USB_ENABLE_bm | (USB_ENDPOINTS_MAX - 1);
     }
   }
@@ -279,6 +349,55 @@ namespace USB {
     USB_EP_STATUS_CLR(USB_EP_RES) = ~USB_TOGGLE_bm;
   }
 
+  /*
+   * A descriptor requested inside a running command is answered
+   * one 64-byte packet at a time from _res_piece, because res_data
+   * overlaps the DAP and VCP buffers the command may still be using.
+   * The automatic ZLP is kept off until the last piece.
+   */
+  void ep_res_piece (void) {
+    size_t _size = _res_length - _res_offset;
+    if (_size > 64) {
+      _size = 64;
+      EP_RES.CTRL &= ~USB_AZLP_bm;
+    }
+    else EP_RES.CTRL |= USB_AZLP_bm;
+    get_descriptor(_res_piece, _res_index, _res_offset, _size);
+    _res_offset += _size;
+    EP_RES.CNT = _size;
+    ep_res_listen();
+  }
+
+  void ep_res_restore (void) {
+    EP_RES.CTRL |= USB_AZLP_bm;
+    EP_RES.DATAPTR = (register16_t)&EP_MEM.res_data;
+    _res_pieces = 0;
+  }
+
+  /* Once the host has taken a piece, the next one is armed. */
+  void ep_res_next (void) {
+    if (!_res_pieces || bit_is_clear(EP_RES.STATUS, USB_BUSNAK_bp)) return;
+    if (_res_offset < _res_length) ep_res_piece();
+    else ep_res_restore();
+  }
+
+  /* An unknown descriptor is left for the main loop to stall. */
+  void ep_res_pieces (void) {
+    if (_res_pieces) ep_res_restore();
+    size_t _length = EP_MEM.req_data.wLength;
+    size_t _size = get_descriptor(_res_piece, EP_MEM.req_data.wValue, 0, 0);
+    if (!_size) return;
+    D1PRINTF(" GD=%04X:%04X\r\n", EP_MEM.req_data.wValue, _size);
+    _res_index  = EP_MEM.req_data.wValue;
+    _res_offset = 0;
+    _res_length = (_size > _length) ? _length : _size;
+    _res_pieces = 1;
+    EP_RES.DATAPTR = (register16_t)&_res_piece;
+    ep_res_piece();
+    ep_req_listen();
+    USB0_INTFLAGSB |= USB_EPSETUP_bp;
+  }
+
   void ep_dpi_listen (void) {
     EP_DPI.CNT = 64;
     EP_DPI.MCNT = 0;
@@ -292,6 +411,27 @@ namespace USB {
     USB_EP_STATUS_CLR(USB_EP_DPO) = ~USB_TOGGLE_bm;
   }
 
+#if defined(CONFIG_USB_VENDOR_BULK)
+  bool is_not_vbulk (void) { return bit_is_clear(EP_VBO.STATUS, USB_BUSNAK_bp); }
+  bool is_vbi_pending (void) { return bit_is_clear(EP_VBI.STATUS, USB_BUSNAK_bp); }
+
+  void ep_vbo_listen (void) {
+    /* Multi-packet reception goes directly into the JTAG packet. */
+    /* It ends with a short packet or a ZLP. */
+    EP_VBO.CNT = 0;
+    EP_VBO.MCNT = USB_VBO_SIZE;
+    loop_until_bit_is_clear(USB0_INTFLAGSB, USB_RMWBUSY_bp);
+    USB_EP_STATUS_CLR(USB_EP_VBO) = ~USB_TOGGLE_bm;
+  }
+
+  void ep_vbi_listen (void) {
+    EP_VBI.CNT = _packet_length;
+    EP_VBI.MCNT = 0;
+    loop_until_bit_is_clear(USB0_INTFLAGSB, USB_RMWBUSY_bp);
+    USB_EP_STATUS_CLR(USB_EP_VBI) = ~USB_TOGGLE_bm;
+  }
+#endif
+
   void ep_cci_listen (void) {
     if ((_send_break + 1) > 1 && _send_break > USB_CCI_INTERVAL) {
       _send_break -= USB_CCI_INTERVAL;
@@ -302,6 +442,44 @@ namespace USB {
     USB_EP_STATUS_CLR(USB_EP_CCI) = ~USB_TOGGLE_bm;
   }
 
+#if defined(CONFIG_VCP_RINGBUFFER)
+  void vcp_ring_clear (void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      _vcp_rxhead = _vcp_rxtail = 0;
+      _vcp_txhead = _vcp_txtail = 0;
+    }
+  }
+
+  uint16_t vcp_rx_pending (void) {
+    uint16_t _head;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { _head = _vcp_rxhead; }
+    return (_head - _vcp_rxtail) & (VCP_RXBUF_SIZE - 1);
+  }
+
+  void ep_cdi_listen (void) {
+    /* Send up to 64 characters of the VCP-RxD ring buffer to the host. */
+    /* While the port is closed or the host is busy, they stay in the ring buffer. */
+    if (bit_is_clear(GPCONF, GPCONF_OPN_bp)
+     || bit_is_clear(EP_CDI.STATUS, USB_BUSNAK_bp)) return;
+    uint16_t _head;
+    uint16_t _tail = _vcp_rxtail;
+    uint8_t  _size = 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { _head = _vcp_rxhead; }
+    if (_head == _tail) return;
+    while (_tail != _head && _size < 64) {
+      EP_MEM.cdi_data[_size++] = _vcp_rxbuf[_tail];
+      _tail = (_tail + 1) & (VCP_RXBUF_SIZE - 1);
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { _vcp_rxtail = _tail; }
+    D2PRINTF(" VI=%02X:", _size);
+    D2PRINTHEX(&EP_MEM.cdi_data[0], _size);
+    EP_CDI.DATAPTR = (register16_t)&EP_MEM.cdi_data[0];
+    EP_CDI.CNT = _size;
+    EP_CDI.MCNT = 0;
+    loop_until_bit_is_clear(USB0_INTFLAGSB, USB_RMWBUSY_bp);
+    USB_EP_STATUS_CLR(USB_EP_CDI) = ~USB_TOGGLE_bm;
+  }
+#else
   void ep_cdi_listen (void) {
     /* Send the VCP-RxD buffer to the host. */
     /* If our math is correct, then if each side of the double */
@@ -330,6 +508,7 @@ namespace USB {
     loop_until_bit_is_clear(USB0_INTFLAGSB, USB_RMWBUSY_bp);
     USB_EP_STATUS_CLR(USB_EP_CDI) = ~USB_TOGGLE_bm;
   }
+#endif
 
   void ep_cdo_listen (void) {
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
@@ -405,14 +584,106 @@ namespace USB {
 
   // MARK: VCP
 
+  void read_drop (void) {
+    if (bit_is_set(EP_CDO.STATUS, USB_BUSNAK_bp)) ep_cdo_listen();
+  }
+
+#if defined(CONFIG_VCP_RINGBUFFER)
+  void vcp_receiver (void) {
+    uint8_t _d = USART0_RXDATAH;
+    uint8_t _c = USART0_RXDATAL;
+    if (!(_d & (USART_BUFOVF_bm | USART_FERR_bm | USART_PERR_bm))) {
+      uint16_t _head = _vcp_rxhead;
+      uint16_t _next = (_head + 1) & (VCP_RXBUF_SIZE - 1);
+      if (_next == _vcp_rxtail) {
+        /* Only when the sender ignores RTS is the character lost. */
+        _d |= USART_BUFOVF_bm;
+      }
+      else {
+        _vcp_rxbuf[_head] = _c;
+        _vcp_rxhead = _next;
+      }
+    #if defined(PIN_VCP_RTS)
+      /* Throttle the sender while there is still room for 64 characters. */
+      if (((_next - _vcp_rxtail) & (VCP_RXBUF_SIZE - 1)) >= VCP_RXBUF_SIZE - 64) {
+        digitalWriteMacro(PIN_VCP_RTS, HIGH);
+      }
+    #endif
+      /* A terminator is flushed by the main loop right away. */
+      _sof_count = _flush_term == (0x100 | _c) ? 0 : _flush_latency;
+    }
+    RXSTAT |= _d;
+  #if defined(CONFIG_VCP_INTERRUPT_SUPPRT)
+    if (bit_is_set(EP_CCI.STATUS, USB_BUSNAK_bp)) cci_interrupt();
+  #endif
+  }
+
+  /* Called from the DRE interrupt. */
+  void vcp_transmitter (void) {
+    uint16_t _tail = _vcp_txtail;
+    if (_tail == _vcp_txhead
+  #if defined(CONFIG_VCP_CTS_ENABLE)
+     || digitalReadMacro(PIN_VCP_CTS)
+  #endif
+     || bit_is_set(GPCONF, GPCONF_BRK_bp)) {
+      /* Stop until the main loop has more to send. */
+      USART0_CTRLA &= ~USART_DREIE_bm;
+      return;
+    }
+    USART0_TXDATAL = _vcp_txbuf[_tail];
+    _vcp_txtail = (_tail + 1) & (VCP_TXBUF_SIZE - 1);
+  }
+
+  void vcp_transceiver (void) {
+    /* A VCP-TxD packet is taken only when it fits in the ring buffer. */
+    /* Until then, EP_CDO keeps NAKing the host. */
+    if (bit_is_set(EP_CDO.STATUS, USB_BUSNAK_bp)) {
+      uint8_t  _size = EP_CDO.CNT;
+      uint16_t _head = _vcp_txhead;
+      uint16_t _tail;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { _tail = _vcp_txtail; }
+      if (_size <= ((_tail - _head - 1) & (VCP_TXBUF_SIZE - 1))) {
+        D2PRINTF(" VO=%02X:", _size);
+        D2PRINTHEX(&EP_MEM.cdo_data, _size);
+        for (uint8_t _i = 0; _i < _size; _i++) {
+          _vcp_txbuf[_head] = EP_MEM.cdo_data[_i];
+          _head = (_head + 1) & (VCP_TXBUF_SIZE - 1);
+        }
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { _vcp_txhead = _head; }
+        ep_cdo_listen();
+      }
+    }
+    if (bit_is_clear(GPCONF, GPCONF_BRK_bp)
+  #if defined(CONFIG_VCP_CTS_ENABLE)
+     && !digitalReadMacro(PIN_VCP_CTS)
+  #endif
+     ) {
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (_vcp_txhead != _vcp_txtail) USART0_CTRLA |= USART_DREIE_bm;
+      }
+    }
+    uint16_t _pending = vcp_rx_pending();
+    if (_pending >= 64 || (_pending && !_sof_count)) ep_cdi_listen();
+  #if defined(PIN_VCP_RTS)
+    /* The sender is released again at half full, if the host asserts RTS. */
+    if (_pending < VCP_RXBUF_SIZE / 2 && _set_line_state.bStateRTS) {
+      digitalWriteMacro(PIN_VCP_RTS, LOW);
+    }
+  #endif
+  }
+#else
   void write_byte (const uint8_t _c) {
     /* The double buffer consists of two blocks. */
     uint8_t* _buf = bit_is_set(GPCONF, GPCONF_DBL_bp)
       ? &EP_MEM.cdi_data[64]
       : &EP_MEM.cdi_data[0];
     _buf[_send_count++] = _c;
-    if (_send_count < 64) _sof_count = 30;
-    else ep_cdi_listen();
+    if (_send_count < 64 && _flush_term != (0x100 | _c)) _sof_count = _flush_latency;
+    else {
+      /* While EP_CDI is busy, the flush is retried on the next SOF. */
+      if (bit_is_clear(EP_CDI.STATUS, USB_BUSNAK_bp)) _sof_count = 1;
+      ep_cdi_listen();
+    }
   }
 
   uint8_t read_byte (void) {
@@ -439,10 +710,6 @@ namespace USB {
     return _s != 0;
   }
 
-  void read_drop (void) {
-    if (bit_is_set(EP_CDO.STATUS, USB_BUSNAK_bp)) ep_cdo_listen();
-  }
-
   void vcp_receiver (void) {
     uint8_t _d = USART0_RXDATAH;
     uint8_t _c = USART0_RXDATAL;
@@ -497,6 +764,246 @@ namespace USB {
   #endif
   }
 
+#endif
+
+  // MARK: VCP2
+
+#if defined(CONFIG_VCP_SECOND)
+  /*
+   * The second VCP on USART1 always runs from ring buffers,
+   * like the first one with CONFIG_VCP_RINGBUFFER.
+   * It has no RTS/CTS, DTR reset or vendor flush request.
+   */
+
+  void set_cci2_data (uint16_t _state) {
+    _vcp2_serial_state = _state;
+    EP_MEM.cci2_header.bmRequestType = 0xA1; /* REQTYPE_DIRECTION | REQTYPE_CLASS | RECIPIENT_INTERFACE */
+    EP_MEM.cci2_header.bRequest      = 0x20; /* CDC_REQ_SerialState */
+    EP_MEM.cci2_header.wValue        = 0;
+    EP_MEM.cci2_header.wIndex        = USB_IF_CDC2;
+    EP_MEM.cci2_header.wLength       = 2;
+    EP_MEM.cci2_wValue               = _state;
+  }
+
+  void vcp2_ring_clear (void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      _vcp2_rxhead = _vcp2_rxtail = 0;
+      _vcp2_txhead = _vcp2_txtail = 0;
+    }
+  }
+
+  void vcp2_clear (void) {
+    USART::disable_vcp2();
+    VCP2CONF = 0;
+    _vcp2_break = 0;
+    _vcp2_sof = 0;
+    _vcp2_rxstat = 0;
+    vcp2_ring_clear();
+    set_cci2_data(0x00);
+  }
+
+  uint16_t vcp2_rx_pending (void) {
+    uint16_t _head;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { _head = _vcp2_rxhead; }
+    return (_head - _vcp2_rxtail) & (VCP2_RXBUF_SIZE - 1);
+  }
+
+  void ep_cci2_listen (void) {
+    if ((_vcp2_break + 1) > 1 && _vcp2_break > USB_CCI_INTERVAL) {
+      _vcp2_break -= USB_CCI_INTERVAL;
+    }
+    EP_CCI2.CNT = 10;
+    EP_CCI2.MCNT = 0;
+    loop_until_bit_is_clear(USB0_INTFLAGSB, USB_RMWBUSY_bp);
+    USB_EP_STATUS_CLR(USB_EP_CCI2) = ~USB_TOGGLE_bm;
+  }
+
+  void ep_cdo2_listen (void) {
+    EP_CDO2.CNT = 0;
+    loop_until_bit_is_clear(USB0_INTFLAGSB, USB_RMWBUSY_bp);
+    USB_EP_STATUS_CLR(USB_EP_CDO2) = ~USB_TOGGLE_bm;
+  }
+
+  void ep_cdi2_listen (void) {
+    /* Send up to 64 characters of the VCP2-RxD ring buffer to the host. */
+    if (bit_is_clear(VCP2CONF, VCP2CONF_OPN_bp)
+     || bit_is_clear(EP_CDI2.STATUS, USB_BUSNAK_bp)) return;
+    uint16_t _head;
+    uint16_t _tail = _vcp2_rxtail;
+    uint8_t  _size = 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { _head = _vcp2_rxhead; }
+    if (_head == _tail) return;
+    while (_tail != _head && _size < 64) {
+      EP_MEM.cdi2_data[_size++] = _vcp2_rxbuf[_tail];
+      _tail = (_tail + 1) & (VCP2_RXBUF_SIZE - 1);
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { _vcp2_rxtail = _tail; }
+    EP_CDI2.CNT = _size;
+    EP_CDI2.MCNT = 0;
+    loop_until_bit_is_clear(USB0_INTFLAGSB, USB_RMWBUSY_bp);
+    USB_EP_STATUS_CLR(USB_EP_CDI2) = ~USB_TOGGLE_bm;
+  }
+
+  void vcp2_break_on (void) {
+    if (bit_is_set(VCP2CONF, VCP2CONF_ENA_bp)
+     && bit_is_clear(VCP2CONF, VCP2CONF_BRK_bp)) {
+      bit_clear(VCP2CONF, VCP2CONF_OPN_bp);
+      _vcp2_sof = 0;
+      USART::disable_vcp2();
+      /* During Break, VCP2-TxD is pulled LOW. */
+      openDrainWriteMacro(PIN_VCP2_TXD, LOW);
+    }
+    bit_set(VCP2CONF, VCP2CONF_BRK_bp);
+  }
+
+  void vcp2_break_off (void) {
+    if (bit_is_set(VCP2CONF, VCP2CONF_ENA_bp)
+     && bit_is_set(VCP2CONF, VCP2CONF_BRK_bp)) {
+      USART::disable_vcp2();
+      USART::change_vcp2();
+      bit_set(VCP2CONF, VCP2CONF_OPN_bp);
+    }
+    bit_clear(VCP2CONF, VCP2CONF_BRK_bp);
+  }
+
+  void vcp2_break_count (void) {
+    /* If the break value is between 1 and 65534, it will count down. */
+    if ((_vcp2_break + 1) > 1) {
+      if (_vcp2_break > USB_CCI_INTERVAL) {
+        if (bit_is_set(EP_CCI2.STATUS, USB_BUSNAK_bp)) ep_cci2_listen();
+      }
+      else {
+        _vcp2_break = 0;
+        vcp2_break_off();
+      }
+    }
+  }
+
+  void vcp2_interrupt (void) {
+  #if defined(CONFIG_VCP_INTERRUPT_SUPPRT)
+    if (bit_is_clear(EP_CCI2.STATUS, USB_BUSNAK_bp)) return;
+    SerialState_t _value = {};
+    uint8_t _d;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      _d = _vcp2_rxstat;
+      _vcp2_rxstat = 0;
+    }
+    if (bit_is_set(_d, USART_FERR_bp))   _value.bFraming = true;
+    if (bit_is_set(_d, USART_PERR_bp))   _value.bParity  = true;
+    if (bit_is_set(_d, USART_BUFOVF_bp)) _value.bOverRun = true;
+    if (bit_is_set(VCP2CONF, VCP2CONF_OPN_bp) && _vcp2_serial_state != _value.bValue) {
+      set_cci2_data(_value.bValue);
+      ep_cci2_listen();
+    }
+  #endif
+  }
+
+  /* Called from the RXC interrupt. */
+  void vcp2_receiver (void) {
+    uint8_t _d = USART1_RXDATAH;
+    uint8_t _c = USART1_RXDATAL;
+    if (!(_d & (USART_BUFOVF_bm | USART_FERR_bm | USART_PERR_bm))) {
+      uint16_t _head = _vcp2_rxhead;
+      uint16_t _next = (_head + 1) & (VCP2_RXBUF_SIZE - 1);
+      if (_next == _vcp2_rxtail) {
+        /* Without flow control, the character is lost. */
+        _d |= USART_BUFOVF_bm;
+      }
+      else {
+        _vcp2_rxbuf[_head] = _c;
+        _vcp2_rxhead = _next;
+      }
+      _vcp2_sof = _vcp2_latency;
+    }
+    _vcp2_rxstat |= _d;
+  }
+
+  /* Called from the DRE interrupt. */
+  void vcp2_transmitter (void) {
+    uint16_t _tail = _vcp2_txtail;
+    if (_tail == _vcp2_txhead || bit_is_set(VCP2CONF, VCP2CONF_BRK_bp)) {
+      /* Stop until the main loop has more to send. */
+      USART1_CTRLA &= ~USART_DREIE_bm;
+      return;
+    }
+    USART1_TXDATAL = _vcp2_txbuf[_tail];
+    _vcp2_txtail = (_tail + 1) & (VCP2_TXBUF_SIZE - 1);
+  }
+
+  void vcp2_transceiver (void) {
+    /* A VCP2-TxD packet is taken only when it fits in the ring buffer. */
+    /* Until the line coding is set, it is dropped. */
+    if (bit_is_set(EP_CDO2.STATUS, USB_BUSNAK_bp)) {
+      uint8_t  _size = EP_CDO2.CNT;
+      uint16_t _head = _vcp2_txhead;
+      uint16_t _tail;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { _tail = _vcp2_txtail; }
+      if (bit_is_clear(VCP2CONF, VCP2CONF_ENA_bp)) ep_cdo2_listen();
+      else if (_size <= ((_tail - _head - 1) & (VCP2_TXBUF_SIZE - 1))) {
+        for (uint8_t _i = 0; _i < _size; _i++) {
+          _vcp2_txbuf[_head] = EP_MEM.cdo2_data[_i];
+          _head = (_head + 1) & (VCP2_TXBUF_SIZE - 1);
+        }
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { _vcp2_txhead = _head; }
+        ep_cdo2_listen();
+      }
+    }
+    if (bit_is_set(VCP2CONF, VCP2CONF_ENA_bp)
+     && bit_is_clear(VCP2CONF, VCP2CONF_BRK_bp)) {
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (_vcp2_txhead != _vcp2_txtail) USART1_CTRLA |= USART_DREIE_bm;
+      }
+    }
+    uint16_t _pending = vcp2_rx_pending();
+    if (_pending >= 64 || (_pending && !_vcp2_sof)) ep_cdi2_listen();
+    if (bit_is_set(VCP2CONF, VCP2CONF_BRK_bp)) vcp2_break_count();
+    else vcp2_interrupt();
+  }
+
+  /*** CDC-ACM requests to the second VCP interfaces. ***/
+  bool request_class_vcp2 (void) {
+    bool _listen = true;
+    uint8_t bRequest = EP_MEM.req_data.bRequest;
+    if (bRequest == 0x20) {       /* SET_LINE_ENCODING */
+      ep_req_pending();
+      _vcp2_break = 0;
+      bit_clear(VCP2CONF, VCP2CONF_BRK_bp);
+      USART::set_line_encoding2(&EP_MEM.res_encoding);
+      D1PRINTF(" SLE2=");
+      D1PRINTHEX(&_vcp2_encoding, sizeof(LineEncoding_t));
+      bit_set(VCP2CONF, VCP2CONF_OPN_bp);
+      _vcp2_sof = 0;
+      vcp2_ring_clear();
+      EP_RES.CNT = 0;
+    }
+    else if (bRequest == 0x21) {  /* GET_LINE_ENCODING */
+      memcpy(&EP_MEM.res_encoding, &_vcp2_encoding, sizeof(LineEncoding_t));
+      if (EP_MEM.res_encoding.dwDTERate == 0) {
+        EP_MEM.res_encoding.dwDTERate = 9600UL;
+        EP_MEM.res_encoding.bDataBits = 8;
+      }
+      EP_RES.CNT = sizeof(LineEncoding_t);
+    }
+    else if (bRequest == 0x22) {  /* SET_LINE_STATE */
+      /* There are no DTR/RTS pins. It is only kept. */
+      D1PRINTF(" SLS2=%02X\r\n", (uint8_t)EP_MEM.req_data.wValue);
+      _vcp2_state.bValue = (uint8_t)EP_MEM.req_data.wValue;
+      EP_RES.CNT = 0;
+    }
+    else if (bRequest == 0x23) {  /* SET_SEND_BREAK */
+      D1PRINTF(" SB2=%04X\r\n", EP_MEM.req_data.wValue);
+      _vcp2_break = EP_MEM.req_data.wValue;
+      if (_vcp2_break) vcp2_break_on();
+      else vcp2_break_off();
+      EP_RES.CNT = 0;
+    }
+    else {
+      _listen = false;
+    }
+    return _listen;
+  }
+#endif
+
   // MARK: USB Session
 
   /*** USB Standard Request Enumeration. ***/
@@ -568,8 +1075,32 @@ namespace USB {
     return _listen;
   }
 
+  /*** The USART side of the CDC-ACM requests. ***/
+  void vcp_line_encoding (LineEncoding_t* _encoding) {
+    USART::set_line_encoding(_encoding);
+    D1PRINTF(" SLE=");
+    D1PRINTHEX(&_set_line_encoding, sizeof(LineEncoding_t));
+    bit_set(GPCONF, GPCONF_OPN_bp);
+    _send_count = 0;
+    _recv_count = 0;
+    _sof_count = 0;
+  #if defined(CONFIG_VCP_RINGBUFFER)
+    vcp_ring_clear();
+  #endif
+  }
+
+  void vcp_send_break (uint16_t _value) {
+    D1PRINTF(" SB=%04X\r\n", _value);
+    _send_break = _value;
+    if (_send_break) break_on();
+    else break_off();
+  }
+
   /*** CDC-ACM request processing. ***/
   bool request_class (void) {
+  #if defined(CONFIG_VCP_SECOND)
+    if ((uint8_t)EP_MEM.req_data.wIndex >= USB_IF_CDC2) return request_class_vcp2();
+  #endif
     bool _listen = true;
     uint8_t bRequest = EP_MEM.req_data.bRequest;
     if (bRequest == 0x0A) {       /* SET_IDLE */
@@ -586,13 +1117,7 @@ namespace USB {
       /* If the same parameter settings persist,  */
       /* it's probably best to do nothing.        */
       ep_req_pending();
-      USART::set_line_encoding(&EP_MEM.res_encoding);
-      D1PRINTF(" SLE=");
-      D1PRINTHEX(&_set_line_encoding, sizeof(LineEncoding_t));
-      bit_set(GPCONF, GPCONF_OPN_bp);
-      _send_count = 0;
-      _recv_count = 0;
-      _sof_count = 0;
+      vcp_line_encoding(&EP_MEM.res_encoding);
       EP_RES.CNT = 0;
     }
     else if (bRequest == 0x21) {  /* GET_LINE_ENCODING */
@@ -616,12 +1141,80 @@ namespace USB {
     else if (bRequest == 0x23) {  /* SET_SEND_BREAK */
       /* When the host application closes the port, it may send a BREAK=0. */
       /* Nothing else is used unless programmed by the application. */
-      D1PRINTF(" SB=%04X\r\n", EP_MEM.req_data.wValue);
-      _send_break = EP_MEM.req_data.wValue;
-      if (_send_break) break_on();
-      else break_off();
+      vcp_send_break(EP_MEM.req_data.wValue);
+      EP_RES.CNT = 0;
+    }
+    else {
+      _listen = false;
+    }
+    return _listen;
+  }
+
+  /*** CDC-ACM requests taken inside a running command. ***/
+  /* The VCP USART may be driving the target, so each change is kept */
+  /* in its pending slot and applied by handling_deferred.            */
+  bool request_class_deferred (void) {
+  #if defined(CONFIG_VCP_SECOND)
+    if ((uint8_t)EP_MEM.req_data.wIndex >= USB_IF_CDC2) return request_class_vcp2();
+  #endif
+    uint8_t bRequest = EP_MEM.req_data.bRequest;
+    if (bRequest == 0x20) {       /* SET_LINE_ENCODING */
+      ep_req_pending();
+      memcpy(&_deferred_encoding, &EP_MEM.res_encoding, sizeof(LineEncoding_t));
+      _deferred_class |= DEFER_ENCODING;
+    }
+    else if (bRequest == 0x21     /* GET_LINE_ENCODING */
+          && (_deferred_class & DEFER_ENCODING)) {
+      memcpy(&EP_MEM.res_encoding, &_deferred_encoding, sizeof(LineEncoding_t));
+      EP_RES.CNT = sizeof(LineEncoding_t);
+      return true;
+    }
+    else if (bRequest == 0x22) {  /* SET_LINE_STATE */
+      _deferred_state = (uint8_t)EP_MEM.req_data.wValue;
+      _deferred_class |= DEFER_STATE;
+    }
+    else if (bRequest == 0x23) {  /* SET_SEND_BREAK */
+      _deferred_break = EP_MEM.req_data.wValue;
+      _deferred_class |= DEFER_BREAK;
+    }
+    else return request_class();
+    D1PRINTF(" DEFER=%02X\r\n", _deferred_class);
+    EP_RES.CNT = 0;
+    return true;
+  }
+
+  /*** Vendor requests for this firmware. ***/
+  bool request_vendor (void) {
+    bool _listen = true;
+    uint8_t bRequest = EP_MEM.req_data.bRequest;
+    if (bRequest == 0x01) {       /* VENDOR_SET_VCP_FLUSH */
+      /* wValue : flush latency LSB=1ms, 0:auto from the baud rate */
+      /* wIndex : 0x100 + terminator character, 0:disable */
+      D1PRINTF(" VFL=%04X:%04X\r\n", EP_MEM.req_data.wValue, EP_MEM.req_data.wIndex);
+      _flush_override = (uint8_t)EP_MEM.req_data.wValue;
+      _flush_term = EP_MEM.req_data.wIndex & 0x1FF;
+      USART::set_flush_latency();
       EP_RES.CNT = 0;
     }
+    else if (bRequest == 0x02) {  /* VENDOR_GET_VCP_FLUSH */
+      EP_MEM.res_data[0] = _flush_latency;
+      EP_MEM.res_data[1] = _flush_override;
+      EP_MEM.res_data[2] = (uint8_t)_flush_term;
+      EP_MEM.res_data[3] = _flush_term >> 8;
+      EP_RES.CNT = 4;
+    }
+    else if (bRequest == 0x03) {  /* VENDOR_GET_PERF */
+  #if defined(CONFIG_SYS_PERFCOUNT)
+      /* Returns Perf_Counter_t as is. wValue=1 clears it after reading. */
+      size_t _length = EP_MEM.req_data.wLength;
+      memcpy(&EP_MEM.res_data, &_perf, sizeof(Perf_Counter_t));
+      EP_RES.CNT = (_length < sizeof(Perf_Counter_t)) ? _length : sizeof(Perf_Counter_t);
+      if (EP_MEM.req_data.wValue == 1) memset(&_perf, 0, sizeof(Perf_Counter_t));
+  #else
+      /* Not built : an empty data stage, unlike the stall of an unknown request. */
+      EP_RES.CNT = 0;
+  #endif
+    }
     else {
       _listen = false;
     }
@@ -631,9 +1224,11 @@ namespace USB {
   /*** Accept the EP0 setup packet. ***/
   /* This process is equivalent to a endpoint interrupt. */
   /* The reason for using polling is to prioritize VCP performance. */
-  void handling_control_transactions (void) {
+  void handling_control_transactions (bool _deferred) {
     bool _listen = false;
     uint8_t bmRequestType = EP_MEM.req_data.bmRequestType;
+    /* A new setup packet ends any descriptor still being answered in pieces. */
+    if (_res_pieces) ep_res_restore();
     D1PRINTF("RQ=%02X:%04X:%02X:%02X:%04X:%04X:%04X\r\n",
       EP_REQ.STATUS, EP_REQ.CNT, EP_MEM.req_data.bmRequestType, EP_MEM.req_data.bRequest,
       EP_MEM.req_data.wValue, EP_MEM.req_data.wIndex, EP_MEM.req_data.wLength);
@@ -644,13 +1239,11 @@ namespace USB {
       _listen = request_standard();
     }
     else if (bmRequestType == (1 << 5)) {
-      _listen = request_class();
+      _listen = _deferred ? request_class_deferred() : request_class();
     }
-  #ifdef _Not_being_used_STUB_
     else if (bmRequestType == (2 << 5)) {
       _listen = request_vendor();
     }
-  #endif
     if (_listen) {
       ep_res_listen();
       ep_req_listen();
@@ -658,6 +1251,25 @@ namespace USB {
     USB0_INTFLAGSB |= USB_EPSETUP_bp;
   }
 
+  /*** Every USB frame, 1ms. ***/
+  void handling_sof (void) {
+    /* Count down the kept UPDI session. It ends at 1. */
+    if (_keep_count > 1) --_keep_count;
+    /* If there is deferred data for a block transfer, it is sent here. */
+    if (_sof_count > 0 && 0 == (--_sof_count)) {
+  #if defined(CONFIG_VCP_RINGBUFFER)
+      ep_cdi_listen();
+  #else
+      if (bit_is_set(EP_CDI.STATUS, USB_BUSNAK_bp) && _send_count > 0) {
+        ep_cdi_listen();
+      }
+  #endif
+    }
+  #if defined(CONFIG_VCP_SECOND)
+    if (_vcp2_sof > 0 && 0 == (--_vcp2_sof)) ep_cdi2_listen();
+  #endif
+  }
+
   /*** This process is equivalent to a bus interrupt. ***/
   /* The reason for using polling is to prioritize VCP performance. */
   /* The trade-off is that power standby is not available. */
@@ -688,14 +1300,7 @@ namespace USB {
       D1PRINTF("<RESUME:%04X>\r\n", USB0_ADDR);
     }
   #endif
-    if (bit_is_set(busstate, USB_SOF_bp)) {
-      /* If there is deferred data for a block transfer, it is sent here. */
-      if (_sof_count > 0 && 0 == (--_sof_count)) {
-        if (bit_is_set(EP_CDI.STATUS, USB_BUSNAK_bp) && _send_count > 0) {
-          ep_cdi_listen();
-        }
-      }
-    }
+    if (bit_is_set(busstate, USB_SOF_bp)) handling_sof();
     if (bit_is_set(busstate, USB_SUSPEND_bp)
      || bit_is_set(busstate, USB_RESUME_bp)) {
       /* This implementation does not transition to power saving mode. */
@@ -711,6 +1316,47 @@ namespace USB {
     }
   }
 
+  /*** EP0 work taken inside the last command, finished from the main loop. ***/
+  void handling_deferred (void) {
+    ep_res_next();
+    if (!_deferred_class) return;
+    uint8_t _defer = _deferred_class;
+    _deferred_class = 0;
+    if (_defer & DEFER_ENCODING) vcp_line_encoding(&_deferred_encoding);
+    if (_defer & DEFER_STATE) USART::set_line_state(_deferred_state);
+    if (_defer & DEFER_BREAK) vcp_send_break(_deferred_break);
+  }
+
+  /*
+   * Service the USB from inside a long target operation.
+   * Called from the blocking wait loops, before they read RXDATA.
+   * A bus reset would reconfigure the endpoints the running command
+   * still uses, so its flag is left set for the main loop.
+   * Descriptors are answered in pieces outside res_data,
+   * and CDC-ACM settings are acknowledged now but applied after the command.
+   */
+  void yield (void) {
+    if (!USB0_CTRLA) return;
+    if (bit_is_set(USB0_INTFLAGSA, USB_SOF_bp)) {
+      USB0_INTFLAGSA = USB_SOF_bm;
+      handling_sof();
+    }
+    if (bit_is_set(GPCONF, GPCONF_BRK_bp)) cci_break_count();
+    ep_res_next();
+    if (!is_ep_setup()) return;
+    uint8_t bmRequestType = EP_MEM.req_data.bmRequestType;
+    uint8_t bRequest = EP_MEM.req_data.bRequest;
+    if ((bmRequestType & ~1) == 0x80 && bRequest == 0x06) {  /* GET_DESCRIPTOR : device or interface */
+      ep_res_pieces();
+    }
+    else if (EP_MEM.req_data.wLength > sizeof(EP_MEM.cci_data)) return;
+    else if ((bmRequestType == 0x80                          /* Device to host, standard, device */
+      && (bRequest == 0x00 || bRequest == 0x08))             /* GET_STATUS, GET_CONFIGURATION */
+     || (bmRequestType & (3 << 5)) == (1 << 5)) {            /* Class */
+      handling_control_transactions(true);
+    }
+  }
+
 };
 
 // end of code